@@ -10,16 +10,29 @@
 #include <string>
 #include <algorithm>
 #include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <future>
+#include <memory>
+#include <map>
+#include <sstream>
+#include <random>
+#include <filesystem>
+#include <type_traits>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
 #include <CL/opencl.hpp>
 
-#ifdef NVIDIA
-    typedef float varhist;
-#else
-    /**
-     * @brief Defines the type used for the variance histogram (float for NVIDIA GPU and int for Intel GPU).
-     */
-    typedef int varhist;
-#endif
+/**
+ * @brief Defines the type used for the variance histogram.
+ * The kernels accumulate it in fixed point and convert it to float, so it is exact and the same on every device.
+ */
+typedef float varhist;
 
 /**
  * @brief This class implements the histogram library.
@@ -30,11 +43,35 @@ class Histogram {
 
     /**
      * @brief This enumeration is to define the image format.
-     * 
+     * YUV (I420), YV12 and I010/I012/I016 are planar 4:2:0, NV12, NV21 and P010/P012/P016 are semi-planar 4:2:0.
+     * I422 and I444 are planar 4:2:2 and 4:4:4, YUYV and UYVY are packed 4:2:2.
+     * YV12 and NV21 store the V channel before the U channel.
+     * High bit depth formats are stored in 16 bit words, aligned to the least significant bit for I0xx and to the most significant bit for P0xx.
      */
     enum class Format {
         YUV,
-        NV12
+        NV12,
+        I010,
+        I012,
+        I016,
+        P010,
+        P012,
+        P016,
+        NV21,
+        YV12,
+        I422,
+        I444,
+        YUYV,
+        UYVY
+    };
+
+    /**
+     * @brief This enumeration is to define the storage type of the raw image samples.
+     * Int expects every sample widened to a 32 bit int, Native expects the samples as they come from the decoder (8 bit, or 16 bit words for high bit depth formats).
+     */
+    enum class Input {
+        Int,
+        Native
     };
 
     /**
@@ -65,6 +102,70 @@ class Histogram {
         Include
     };
 
+    /**
+     * @brief This enumeration is used to select the policy for the blocks that cross the right and bottom edges of the image.
+     * Discard drops them, Partial calculates them with the pixels inside the image, Clamp repeats the last row and column of the image.
+     */
+    enum class Edge {
+        Discard,
+        Partial,
+        Clamp
+    };
+
+    /**
+     * @brief This enumeration is used to select how the data is moved between the host and the device.
+     * Copy uses explicit reads and writes, ZeroCopy allocates the buffers in host accessible memory so a frame written through mapInputBuffer is never copied and the outputs are mapped instead of read, and Auto uses ZeroCopy when the device shares its memory with the host (integrated GPUs and CPU devices).
+     */
+    enum class Memory {
+        Copy,
+        ZeroCopy,
+        Auto
+    };
+
+    /**
+     * @brief This enumeration is used to select how the histograms of the work groups are merged.
+     * Atomic adds them to the histograms with global atomics, TwoStage writes the partial histogram of every work group to a scratch buffer and adds them in a fixed order with a second kernel, without global atomics.
+     */
+    enum class Reduction {
+        Atomic,
+        TwoStage
+    };
+
+    /**
+     * @brief This enumeration is used to select whether the histograms of the frames are accumulated.
+     * Frame calculates the histograms of every frame on their own, Stream also adds the histograms of every frame calculated with calculateHistograms to 64 bit totals kept on the device, without reading the frames back.
+     */
+    enum class Accumulation {
+        Frame,
+        Stream
+    };
+
+    /**
+     * @brief This enumeration is used to select where the histograms are calculated.
+     * OpenCL uses the GPU, CPU uses the native multithreaded backend of the library without any OpenCL device, and Auto uses the GPU when there is one and the CPU backend otherwise.
+     * Hybrid splits the block rows of every frame calculated with calculateHistograms between the OpenCL device and the CPU backend, following their measured throughput.
+     * Adaptive sends every frame calculated with calculateHistograms to the OpenCL device or to the CPU backend, whichever has taken less time for the configuration in the previous frames.
+     * Both read the frame written with writeInputBuffers from the memory of the caller when it is calculated, so it must stay valid until then.
+     */
+    enum class Backend {
+        Auto,
+        OpenCL,
+        CPU,
+        Hybrid,
+        Adaptive
+    };
+
+    /**
+     * @brief This enumeration is used to select the type of OpenCL device.
+     * GPU also matches integrated GPUs, CPU matches OpenCL CPU runtimes such as PoCL, and Any matches every device of the platform.
+     */
+    enum class DeviceType {
+        GPU,
+        CPU,
+        Accelerator,
+        Any
+    };
+
     /**
      * @brief This enumeration is used to display errors or not.
      * 
@@ -74,6 +175,76 @@ class Histogram {
         ShowError
     };
 
+    /**
+     * @brief This structure describes a plane of the raw image data, as handed by decoders and hardware surfaces.
+     * The rows of the plane may be padded, only the first row width samples of every row are read.
+     */
+    struct Plane {
+        /**
+         * @brief Pointer to the first row of the plane, stored as the input type.
+         */
+        const void *data;
+
+        /**
+         * @brief Distance in bytes between the start of two consecutive rows.
+         */
+        int pitch;
+    };
+
+    /**
+     * @brief This structure is a read only view of the results of the environment, the data is not copied.
+     * It is valid until the next calculation or change of configuration.
+     */
+    template <typename T>
+    struct View {
+        /**
+         * @brief Pointer to the first value.
+         */
+        const T *data;
+
+        /**
+         * @brief Number of values.
+         */
+        size_t size;
+
+        const T *begin() const {
+            return data;
+        }
+
+        const T *end() const {
+            return data + size;
+        }
+
+        const T &operator[](size_t index) const {
+            return data[index];
+        }
+    };
+
+    /**
+     * @brief This structure holds the results of a frame submitted for asynchronous calculation.
+     * The details (average and variance of each block) are only filled if they were requested.
+     */
+    struct Result {
+        // Average and variance of each block
+        std::vector<float> yAverage;
+        std::vector<float> uAverage;
+        std::vector<float> vAverage;
+        std::vector<float> yVariance;
+        std::vector<float> uVariance;
+        std::vector<float> vVariance;
+
+        // Histograms
+        std::vector<int> yAverageBins;
+        std::vector<int> uAverageBins;
+        std::vector<int> vAverageBins;
+        std::vector<varhist> yVarianceBins;
+        std::vector<varhist> uVarianceBins;
+        std::vector<varhist> vVarianceBins;
+
+        // Kernel execution time in milliseconds
+        double elapsedTime;
+    };
+
     /**
      * @brief Default constructor for the histogram class.
      * The default constructor uses a YUV format, chromatic option, with full hd image size (1920x1080), 8x8 pixel block, and 16 bins.
@@ -93,6 +264,20 @@ class Histogram {
      */
     Histogram(Format format, Color color, int imgWidth, int imgHeight, int blockWidth, int blockHeight, int numOfBins);
 
+    /**
+     * @brief Constructor for the histogram class with the storage type of the raw data.
+     * 
+     * @param format the image format of the raw data.
+     * @param color the chromatic options for the image.
+     * @param input the storage type of the raw data samples.
+     * @param imgWidth the width of the image.
+     * @param imgHeight the height of the image.
+     * @param blockWidth the width of the pixel blocks.
+     * @param blockHeight the height of the pixel blocks.
+     * @param numOfBins the number of bins for the histograms.
+     */
+    Histogram(Format format, Color color, Input input, int imgWidth, int imgHeight, int blockWidth, int blockHeight, int numOfBins);
+
     /**
      * @brief Copy constructor.
      * 
@@ -102,13 +287,14 @@ class Histogram {
 
     /**
      * @brief Destructor.
+     * Waits for the frames submitted that are still being read back.
      * 
      */
     ~Histogram();
 
     /**
      * @brief Sets up the initial environment for the GPU.
-     * Perform initialization of OpenCL device and allocates memory buffers.
+     * Perform initialization of OpenCL device and allocates memory buffers, or selects the CPU backend when there is no GPU.
      * Needs to be executed before any other calculation method.
      */
     void setupEnvironment();
@@ -122,17 +308,55 @@ class Histogram {
     /**
      * @brief Write the input memory buffer with the raw image data.
      * 
-     * @param imageVector vector that contains the raw image data in YUV or NV12 formats.
+     * @param imageVector vector that contains the raw image data in any of the supported formats.
      */
     void writeInputBuffers(std::vector<int> imageVector);
 
+    /**
+     * @brief Write the input memory buffer with the raw 8 bit image data.
+     * Requires the Native input type and an 8 bit format.
+     * The vector is not copied by the Hybrid and Adaptive backends, as for writeInputBuffers(const void *).
+     * 
+     * @param imageVector vector that contains the raw image data in any of the 8 bit formats.
+     */
+    void writeInputBuffers(const std::vector<uint8_t> &imageVector);
+
+    /**
+     * @brief Write the input memory buffer with the raw high bit depth image data.
+     * Requires the Native input type and a high bit depth format.
+     * The vector is not copied by the Hybrid and Adaptive backends, as for writeInputBuffers(const void *).
+     * 
+     * @param imageVector vector that contains the raw image data in I010, I012, I016, P010, P012 or P016 formats.
+     */
+    void writeInputBuffers(const std::vector<uint16_t> &imageVector);
+
     /**
      * @brief Write the input memory buffer with the raw image data.
+     * With the Hybrid and Adaptive backends the frame is not copied but read from the memory of the caller when it is calculated, so that memory must stay valid and unchanged until calculateHistograms returns.
      * 
-     * @param ptr pointer to memory that contains the raw image data in YUV or NV12 formats.
+     * @param ptr pointer to memory that contains the raw image data in any of the supported formats, stored as the input type.
      */
     void writeInputBuffers(const void *ptr);
 
+    /**
+     * @brief Write the input memory buffer with the raw image data given as separate, possibly pitched, planes.
+     * Planar formats take the Y, U and V planes (V before U for YV12), semi-planar formats take the Y and the interleaved chroma plane, and packed formats take a single plane.
+     * The planes are copied as they are and the kernels index them by their pitch, so no repacking is done on the host.
+     * The Hybrid and Adaptive backends read the planes from the memory of the caller, which must stay valid until the frame is calculated, as for writeInputBuffers(const void *).
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     */
+    void writeInputBuffers(const std::vector<Plane> &planes);
+
+    /**
+     * @brief Maps the input memory buffer, so the next frame is written straight into it instead of being copied by writeInputBuffers.
+     * The frame is written as tightly packed planes stored back to back, and the buffer is unmapped by the next calculation.
+     * With ZeroCopy memory the device reads the frame where it was written, the CPU, Hybrid and Adaptive backends get host memory for it.
+     * 
+     * @return void* pointer to the memory of the frame, of imageSize samples of the input type, or NULL on error.
+     */
+    void *mapInputBuffer();
+
     /**
      * @brief Sets the Image Size for the enviroment.
      * Used if the image size needs to be changed dynamically.
@@ -145,6 +369,7 @@ class Histogram {
     /**
      * @brief Sets the Block Size for the enviroment.
      * Used if the block size needs to be changed dynamically.
+     * A block of high bit depth samples is rejected if its variance cannot be calculated in 64 bits, above 65537 pixels for 16 bit samples.
      * 
      * @param blockWidth the width of the pixel blocks.
      * @param blockHeight the height of the pixel blocks.
@@ -159,6 +384,134 @@ class Histogram {
      */
     void setNumofBins(int numOfBins);
 
+    /**
+     * @brief Sets the Edge policy for the environment.
+     * Used to keep the blocks that cross the right and bottom edges when the image size is not a multiple of the block size.
+     * 
+     * @param edge the edge policy desired.
+     */
+    void setEdge(Edge edge);
+
+    /**
+     * @brief Sets the Memory mode for the environment.
+     * Needs to be set before the environment is set up.
+     * 
+     * @param memory the memory mode desired.
+     */
+    void setMemory(Memory memory);
+
+    /**
+     * @brief Sets the Reduction mode for the environment.
+     * 
+     * @param reduction the reduction mode desired.
+     */
+    void setReduction(Reduction reduction);
+
+    /**
+     * @brief Sets the Accumulation mode for the environment.
+     * With Stream the frames calculated with calculateHistograms are added to the totals and not read back, so their result is not written, and the totals are read with getAccumulatedAverageHistogram and getAccumulatedVarianceHistogram.
+     * The frames are calculated on the OpenCL device with every backend but the CPU one, which keeps the totals on the host.
+     * 
+     * @param accumulation the accumulation mode desired.
+     */
+    void setAccumulation(Accumulation accumulation);
+
+    /**
+     * @brief Clears the totals accumulated across frames.
+     * 
+     */
+    void resetAccumulation();
+
+    /**
+     * @brief Sets the Backend for the environment.
+     * Needs to be set before the environment is set up.
+     * 
+     * @param backend the backend desired.
+     */
+    void setBackend(Backend backend);
+
+    /**
+     * @brief Sets the number of threads used by the CPU backend, each one calculating a range of block rows.
+     * 
+     * @param threads the number of threads, 0 to use every hardware thread (defaults to 0).
+     */
+    void setThreads(int threads);
+
+    /**
+     * @brief Sets the OpenCL platform used by the environment.
+     * The name is matched, ignoring case, as a substring of the name or the vendor of the platform.
+     * Needs to be set before the environment is set up.
+     * 
+     * @param name the platform name or vendor, empty to search every platform (defaults to empty).
+     */
+    void setPlatform(const std::string &name);
+
+    /**
+     * @brief Sets the OpenCL device used by the environment.
+     * The name is matched, ignoring case, as a substring of the name or the vendor of the device, and the index counts the matching devices of every selected platform.
+     * Needs to be set before the environment is set up.
+     * 
+     * @param type the type of the device (defaults to GPU).
+     * @param name the device name or vendor, empty to match every device (defaults to empty).
+     * @param index the index of the device among the matching ones (defaults to 0).
+     */
+    void setDevice(DeviceType type, const std::string &name = "", int index = 0);
+
+    /**
+     * @brief Partitions the device into sub-devices of the given number of compute units and uses one of them.
+     * Several instances partitioning the same CPU device with different indexes each own a slice of its cores, so independent streams do not compete for them.
+     * Needs a device that supports CL_DEVICE_PARTITION_EQUALLY (usually OpenCL CPU devices), otherwise the whole device is used.
+     * Needs to be set before the environment is set up.
+     * 
+     * @param computeUnits the compute units of each sub-device, 0 to use the whole device (defaults to 0).
+     * @param index the index of the sub-device used (defaults to 0).
+     */
+    void setSubDevice(int computeUnits, int index = 0);
+
+    /**
+     * @brief Sets the number of consecutive blocks of a row calculated by each work group.
+     * The bins of the blocks are accumulated in local memory and merged into the histograms once per work group, which removes the contention of the global atomics on flat content where every block falls in the same bin.
+     * It is rounded up to the number of blocks that the work group calculates at the same time.
+     * 
+     * @param blocks the number of blocks per work group (defaults to 8).
+     */
+    void setBlocksPerGroup(int blocks);
+
+    /**
+     * @brief Sets the number of work items of each work group, independently of the block size.
+     * It is rounded down to a power of two and limited to the maximum work group size of the device.
+     * 
+     * @param size the work group size, 0 to choose it for the device (defaults to 0, 256 work items when the device allows it).
+     */
+    void setWorkGroupSize(int size);
+
+    /**
+     * @brief Sets the number of samples of a block calculated by each work item (thread coarsening).
+     * Blocks are calculated by as many work items as needed for this, up to the work group size, and small blocks share a work group so it runs at full occupancy.
+     * 
+     * @param pixels the number of samples per work item (defaults to 4).
+     */
+    void setPixelsPerItem(int pixels);
+
+    /**
+     * @brief Sets the directory where the built kernel programs are stored.
+     * The binaries are keyed by device, driver version, kernel source and build options, so later processes load them instead of building the kernels again.
+     * Must be called before setupEnvironment to speed up its build.
+     * 
+     * @param directory the cache directory, created if it does not exist (defaults to empty, which disables the cache).
+     */
+    void setCacheDirectory(const std::string &directory);
+
+    /**
+     * @brief Sets the file where the tuned launch configurations are stored, which enables the tuning.
+     * On the first setupEnvironment for a device, driver, format, image size, block size, number of bins and edge policy, the reduction, work group size, pixels per item and blocks per group are chosen by timing the kernels on a synthetic frame, one parameter at a time.
+     * The winner is stored in the file and applied by later setupEnvironment calls, replacing the values given to setReduction, setWorkGroupSize, setPixelsPerItem and setBlocksPerGroup.
+     * Must be called before setupEnvironment.
+     * 
+     * @param file the tuning file, created if it does not exist (defaults to empty, which disables the tuning).
+     */
+    void setTuningFile(const std::string &file);
+
     /**
      * @brief Set the Error Level.
      * If set to display, errors will be displayed as they occur.
@@ -186,6 +539,56 @@ class Histogram {
      */
     void calculateHistograms(Detail detail);
 
+    /**
+     * @brief Calculates the histograms of the image in the buffers into a result owned by the caller.
+     * The vectors of the result are only allocated when their size changes, so reusing the same result for every frame of a stream does not allocate nor copy the data again.
+     * The details of the result are only written if they were requested.
+     * 
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the data is stored.
+     */
+    void calculateHistograms(Detail detail, Result &result);
+
+    /**
+     * @brief Submits a frame for asynchronous calculation of the histograms.
+     * The frame is uploaded before returning, so its memory can be reused right away, while the kernel and the read back run in the background.
+     * Up to the number of in flight frames are calculated at the same time, each one with its own set of buffers and queue, so the transfers of a frame overlap the calculation of the others.
+     * 
+     * @param ptr pointer to memory that contains the raw image data in any of the supported formats, stored as the input type.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @return std::future<Result> that waits for the results of the frame when they are requested.
+     */
+    std::future<Result> submit(const void *ptr, Detail detail);
+
+    /**
+     * @brief Submits a frame given as separate, possibly pitched, planes for asynchronous calculation of the histograms.
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @return std::future<Result> that waits for the results of the frame when they are requested, or an invalid future if the planes do not match the format.
+     */
+    std::future<Result> submit(const std::vector<Plane> &planes, Detail detail);
+
+    /**
+     * @brief Sets the number of frames that can be calculated at the same time by submit.
+     * Two frames allow double buffering and three allow the upload, calculation and read back of different frames to overlap.
+     * 
+     * @param frames the number of frames in flight (defaults to 3).
+     */
+    void setInFlightFrames(int frames);
+
+    /**
+     * @brief Calculates the histograms of a batch of frames with a single kernel launch.
+     * The frames are tightly packed and stored back to back, and the frame index is the third dimension of the launch, so short clips or thumbnails do not pay the launch and transfer overhead once per frame.
+     * The elapsed time of each result is its share of the batch, the elapsed time of the environment is the time of the whole batch.
+     * 
+     * @param ptr pointer to memory that contains the raw image data of the frames in any of the supported formats, stored as the input type.
+     * @param numOfFrames the number of frames in the batch.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @return std::vector<Result> with the results of each frame.
+     */
+    std::vector<Result> calculateBatch(const void *ptr, int numOfFrames, Detail detail);
+
     /**
      * @brief Gets the average data for the given channel.
      * The average data is a vector that represents each group (block of pixels).
@@ -221,136 +624,1005 @@ class Histogram {
     std::vector<varhist> getVarianceHistogram(Channel channel);
 
     /**
-     * @brief Gets the elapsed time for the previous calculations.
+     * @brief Gets a view of the average data for the given channel, without copying it.
      * 
-     * @return double with the elapsed time.
+     * @param channel selects the channel to return the data from.
+     * @return View<float> of the average data.
      */
-    double getElapsedTime();
+    View<float> viewAverage(Channel channel);
 
-    private:
     /**
-     * @brief Calculates the sizes of buffers and vectors needed for the environment.
+     * @brief Gets a view of the variance data for the given channel, without copying it.
      * 
+     * @param channel selects the channel to return the data from.
+     * @return View<float> of the variance data.
      */
-    void calculateSizes();
+    View<float> viewVariance(Channel channel);
 
     /**
-     * @brief Creates the input memory buffers.
+     * @brief Gets a view of the average histogram data for the given channel, without copying it.
      * 
+     * @param channel selects the channel to return the data from.
+     * @return View<int> of the average histogram data.
      */
-    void createInputBuffers();
+    View<int> viewAverageHistogram(Channel channel);
 
     /**
-     * @brief Creates the output memory buffers.
+     * @brief Gets a view of the variance histogram data for the given channel, without copying it.
      * 
+     * @param channel selects the channel to return the data from.
+     * @return View<varhist> of the variance histogram data.
      */
-    void createOutputBuffers();
+    View<varhist> viewVarianceHistogram(Channel channel);
 
     /**
-     * @brief Create a output vectors.
+     * @brief Registers host memory owned by the caller where the outputs of the frames calculated on the device are read.
+     * The outputs are read straight into it with a single transfer and the views point into it, so steady state processing does not allocate nor copy the data.
+     * It must hold getOutputMemorySize bytes and stay valid while it is registered, a NULL pointer reads the outputs to memory of the environment again.
      * 
+     * @param ptr pointer to the memory of the outputs.
+     * @param size the size in bytes of the memory.
      */
-    void createOutputVectors();
+    void setOutputMemory(void *ptr, size_t size);
 
     /**
-     * @brief Helper function used to adjust the dimension to fit the block size evenly. 
-     *
-     * @param dimension image dimension to be used.
-     * @param blockDimension block dimension to be compared to
-     * @return int with adjusted dimension.
+     * @brief Gets the size of the memory needed to register the outputs of a frame, which changes with the configuration.
+     * It is 0 with the CPU backend, which calculates the outputs in the memory of the environment.
+     * 
+     * @return size_t with the size in bytes.
      */
-    int adjustDimension(int dimension, int blockDimension);
+    size_t getOutputMemorySize();
 
-    // Control
-    bool environmentSetUp;
+    /**
+     * @brief Gets the average histogram accumulated across the frames since the last reset for the given channel.
+     * 
+     * @param channel selects the channel to return the data from.
+     * @return std::vector<cl_ulong> of the accumulated average histogram data.
+     */
+    std::vector<cl_ulong> getAccumulatedAverageHistogram(Channel channel);
 
-    // Image and Block
-    int imgWidth;
-    int imgHeight;
-    int blockWidth;
-    int blockHeight;
-    int numOfBins;
-    Format format;
-    Color color;
+    /**
+     * @brief Gets the variance histogram accumulated across the frames since the last reset for the given channel.
+     * 
+     * @param channel selects the channel to return the data from.
+     * @return std::vector<double> of the accumulated variance histogram data.
+     */
+    std::vector<double> getAccumulatedVarianceHistogram(Channel channel);
 
-    // Channel Details
-    int ySize;
-    int uSize;
-    int vSize;
-    int imageSize;
+    /**
+     * @brief Gets the number of frames accumulated since the last reset.
+     * 
+     * @return int with the number of frames.
+     */
+    int getAccumulatedFrames();
 
-    int yBlockWidth;
-    int yBlockHeight;
-    int yBlockSize;
-    int yNumOfBlocks;
+    /**
+     * @brief Gets the elapsed time for the previous calculations.
+     * 
+     * @return double with the elapsed time.
+     */
+    double getElapsedTime();
 
-    int uBlockWidth;
-    int uBlockHeight;
-    int uBlockSize;
-    int uNumOfBlocks;
+    /**
+     * @brief Gets the backend that calculated the previous frame with calculateHistograms.
+     * With the Adaptive backend it is the backend chosen for the frame, OpenCL or CPU.
+     * 
+     * @return Backend used for the previous calculations.
+     */
+    Backend getLastBackend();
 
-    int vBlockWidth; 
-    int vBlockHeight;
-    int vBlockSize;
-    int vNumOfBlocks;
+    private:
+    /**
+     * @brief Layout of the outputs of a buffer set in its output buffer, as offsets in bytes.
+     * The histograms of each channel come first, with the fixed point variance histograms added up by the hybrid backend, then the details, in the order of the members, and every output starts at the base address alignment of the device and holds every frame of the set.
+     */
+    struct OutputLayout {
+        size_t yAverageHist = 0;
+        size_t yVarianceHist = 0;
+        size_t yVarianceFixed = 0;
+        size_t uAverageHist = 0;
+        size_t uVarianceHist = 0;
+        size_t uVarianceFixed = 0;
+        size_t vAverageHist = 0;
+        size_t vVarianceHist = 0;
+        size_t vVarianceFixed = 0;
+        size_t yAverage = 0;
+        size_t yVariance = 0;
+        size_t uAverage = 0;
+        size_t uVariance = 0;
+        size_t vAverage = 0;
+        size_t vVariance = 0;
+        size_t size = 0;
 
-    // Error
-    bool showErrors;
-    int clError;
-    int histError;
+        // Number of bins of each histogram and of blocks of each channel of a frame
+        int numOfBins = 0;
+        int numOfBlocks = 0;
+    };
 
-    // Platform Devices Queue
-    cl::Platform platform;
-    std::vector<cl::Device> devices;
-    cl::Device defaultDevice;
-    cl::Program program;
-    cl::Context context;
-    cl::CommandQueue commandQueue;
+    /**
+     * @brief Set of buffers used to calculate a frame, with the queue where its commands are enqueued.
+     * 
+     */
+    struct BufferSet {
+        cl::CommandQueue queue;
+        cl::Event event;
+        int numOfFrames = 1;
 
-    // Kernels
-    cl::Kernel histogramsKernel;
-    cl::Kernel histogramsDetailKernel;
-    cl::Kernel singleChannelKernel;
-    cl::Kernel singleChannelDetailKernel;
+        // Input Buffers
+        cl::Buffer imageBuffer;
+        size_t imageBufferSize;
+        cl::Buffer numOfBinsBuffer;
+        cl::Buffer formatBuffer;
+        std::vector<int> formatDescriptor;
 
-    // Ranges
-    cl::NDRange globalRange;
-    cl::NDRange localRange;
-    cl::Event event;
+        // Output Buffers, sub-buffers of a single output buffer so a frame is read back with a single transfer
+        // The host memory a submitted frame is read to is shared with its future, and held by the set until the read is finished
+        cl::Buffer outputBuffer;
+        OutputLayout layout;
+        std::vector<char> hostOutput;
+        std::shared_ptr<std::vector<char>> pendingOutput;
+        void *mappedOutput = NULL;
+        cl::Buffer yAverageBuffer;
+        cl::Buffer uAverageBuffer;
+        cl::Buffer vAverageBuffer;
+        cl::Buffer yVarianceBuffer;
+        cl::Buffer uVarianceBuffer;
+        cl::Buffer vVarianceBuffer;
+        cl::Buffer yAverageHistBuffer;
+        cl::Buffer uAverageHistBuffer;
+        cl::Buffer vAverageHistBuffer;
+        cl::Buffer yVarianceHistBuffer;
+        cl::Buffer uVarianceHistBuffer;
+        cl::Buffer vVarianceHistBuffer;
+        cl::Buffer yVarianceFixedBuffer;
+        cl::Buffer uVarianceFixedBuffer;
+        cl::Buffer vVarianceFixedBuffer;
+
+        // Scratch Buffers (two stage reduction)
+        int numOfGroups = 0;
+        cl::Buffer yPartialAverageBuffer;
+        cl::Buffer uPartialAverageBuffer;
+        cl::Buffer vPartialAverageBuffer;
+        cl::Buffer yPartialVarianceBuffer;
+        cl::Buffer uPartialVarianceBuffer;
+        cl::Buffer vPartialVarianceBuffer;
+    };
+
+    /**
+     * @brief Threads of the CPU backend, started once by the instance and reused by every frame and every hybrid split.
+     * 
+     */
+    class WorkerPool {
+        public:
+        /**
+         * @brief Starts the worker threads, one less than numOfThreads as the calling thread also runs tasks.
+         * 
+         * @param numOfThreads the number of threads that run the tasks, including the calling thread.
+         */
+        WorkerPool(int numOfThreads);
+
+        /**
+         * @brief Stops and joins the worker threads.
+         * 
+         */
+        ~WorkerPool();
+
+        /**
+         * @brief Runs the tasks on the worker threads and the calling thread, and waits until all of them are done.
+         * 
+         * @param numOfTasks the number of tasks, task is called once with each index from 0 to numOfTasks - 1.
+         * @param task the task to be run.
+         */
+        void run(int numOfTasks, const std::function<void(int)> &task);
+
+        /**
+         * @brief Helper function used to get the number of threads of the pool, including the calling thread.
+         * 
+         * @return int with the number of threads.
+         */
+        int size();
+
+        private:
+        /**
+         * @brief Loop of the worker threads, which wait for tasks until the pool is stopped.
+         * 
+         */
+        void work();
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable taskReady;
+        std::condition_variable tasksDone;
+        const std::function<void(int)> *task = NULL;
+        int numOfTasks = 0;
+        int nextTask = 0;
+        int pendingTasks = 0;
+        bool stop = false;
+    };
+
+    /**
+     * @brief Selects the device of the environment, from the platforms and devices matching the configuration, and partitions it into sub-devices if asked for.
+     * 
+     * @return true if a device was found.
+     */
+    bool selectDevice();
+
+    /**
+     * @brief Checks that the planes of the raw image data match the format.
+     * 
+     * @param planes the planes of the raw image data.
+     * @return true if there is a plane for each plane of the format and their pitches hold a row of samples.
+     */
+    bool validPlanes(const std::vector<Plane> &planes);
+
+    /**
+     * @brief Gets the geometry of the planes of the raw image data, the width and height of every plane and the size of their samples.
+     * 
+     * @return std::vector<int> with the geometry of the planes.
+     */
+    std::vector<int> planeGeometry();
+
+    /**
+     * @brief Keeps the planes of the frame calculated by the backends on the host, with the geometry they were written for.
+     * 
+     * @param planes the planes of the raw image data, or an empty vector if the frame written is not valid.
+     */
+    void setHostPlanes(const std::vector<Plane> &planes);
+
+    /**
+     * @brief Checks that a frame was written with the current format and image size before it is calculated.
+     * 
+     * @return true if the frame can be calculated.
+     */
+    bool validFrame();
+
+    /**
+     * @brief Copies the planes of the raw image data to host memory for the CPU backend, keeping their pitch.
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     */
+    void writeHostImage(const std::vector<Plane> &planes);
+
+    /**
+     * @brief Calculates the histograms of a frame with the CPU backend.
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the data is stored.
+     * @param totals the totals where the histograms are added, NULL to not accumulate them.
+     */
+    void calculateFrameCPU(const std::vector<Plane> &planes, Detail detail, Result &result, std::vector<cl_ulong> *totals);
+
+    /**
+     * @brief Calculates a range of block rows of a frame with the CPU backend, adding them to the histograms of the result.
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the average histograms and the details are stored.
+     * @param firstBlockY the first block row calculated.
+     * @param lastBlockY the block row after the last one calculated.
+     * @param fixedVarianceBins the fixed point variance histograms of every channel, one after another.
+     */
+    void calculateRowsCPU(const std::vector<Plane> &planes, Detail detail, Result &result, int firstBlockY, int lastBlockY, std::vector<cl_ulong> &fixedVarianceBins);
+
+    /**
+     * @brief Calculates a range of block rows of a frame with the CPU backend for a storage type of the samples and a type of the block accumulators.
+     * 
+     * @param planes the planes of the raw image data, stored as the input type.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the average histograms and the details are stored.
+     * @param firstBlockY the first block row calculated.
+     * @param lastBlockY the block row after the last one calculated.
+     * @param fixedVarianceBins the fixed point variance histograms of every channel, one after another.
+     */
+    template <typename T, typename A>
+    void calculateRowsCPU(const std::vector<Plane> &planes, Detail detail, Result &result, int firstBlockY, int lastBlockY, std::vector<cl_ulong> &fixedVarianceBins);
+
+    /**
+     * @brief Converts the fixed point variance histograms to the float histograms of the result, as the kernels do.
+     * 
+     * @param fixedVarianceBins the fixed point variance histograms of every channel, one after another.
+     * @param result the result where the histograms are stored.
+     */
+    void convertVarianceBins(const std::vector<cl_ulong> &fixedVarianceBins, Result &result);
+
+    /**
+     * @brief Calculates the frame in the buffers with the OpenCL device.
+     * 
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the data is stored.
+     */
+    void calculateFrameDevice(Detail detail, Result &result);
+
+    /**
+     * @brief Calculates the frame in host memory with the adaptive backend.
+     * The frame goes to the backend with the lower time measured for the configuration, the other one is measured again every 32 frames in case the costs change.
+     * 
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the data is stored.
+     */
+    void calculateFrameAdaptive(Detail detail, Result &result);
+
+    /**
+     * @brief Helper function used to get the key of the costs of the adaptive backend, the configuration the frames are calculated with.
+     * 
+     * @param detail the option to perform calculations with our without returning the details.
+     * @return std::string with the key of the configuration.
+     */
+    std::string dispatchKey(Detail detail);
+
+    /**
+     * @brief Calculates the frame in the buffers with the hybrid backend.
+     * The first block rows are calculated by the device while the CPU backend calculates the rest, and their histograms are added in fixed point.
+     * The split follows the time per block row measured on each side in the previous frames.
+     * 
+     * @param detail the option to perform calculations with our without returning the details.
+     * @param result the result where the data is stored.
+     */
+    void calculateFrameHybrid(Detail detail, Result &result);
+
+    /**
+     * @brief Helper function used to get the plane of the raw image data that holds a channel.
+     * 
+     * @param channel the channel (0 for Y, 1 for U, 2 for V).
+     * @return int with the index of the plane.
+     */
+    int channelPlane(int channel);
+
+    /**
+     * @brief Helper function used to get the instruction set used by the CPU backend.
+     * AVX2 or SSE4.1 is selected at run time when the processor supports it, with scalar code otherwise.
+     * 
+     * @return std::string with the name of the instruction set.
+     */
+    static std::string instructionSet();
+
+    /**
+     * @brief Helper function used to get the number of threads used by the CPU backend.
+     * 
+     * @return int with the number of threads set by setThreads, or the number of hardware threads.
+     */
+    int cpuThreads();
+
+    /**
+     * @brief Helper function used to get the worker pool of the CPU backend, which is started on first use with cpuThreads threads.
+     * 
+     * @return WorkerPool& with the pool of the instance.
+     */
+    WorkerPool &workerPool();
+
+    /**
+     * @brief Calculates the sizes of buffers and vectors needed for the environment.
+     * 
+     */
+    void calculateSizes();
+
+    /**
+     * @brief Creates the input memory buffers.
+     * 
+     * @param set the buffer set where the buffers are created.
+     */
+    void createInputBuffers(BufferSet &set);
+
+    /**
+     * @brief Creates the output memory buffers.
+     * 
+     * @param set the buffer set where the buffers are created.
+     */
+    void createOutputBuffers(BufferSet &set);
+
+    /**
+     * @brief Creates the buffer with the histograms accumulated across frames.
+     */
+    void createTotalBuffer();
+
+    /**
+     * @brief Creates an output memory buffer as a region of the output buffer of a buffer set.
+     * 
+     * @param set the buffer set with the output buffer.
+     * @param origin the offset of the region in bytes.
+     * @param size the size of the region in bytes.
+     * @param name the name of the buffer shown in the errors.
+     * @return cl::Buffer of the region.
+     */
+    cl::Buffer createOutputRegion(BufferSet &set, size_t origin, size_t size, std::string name);
+
+    /**
+     * @brief Create a output vectors.
+     * 
+     * @param result the result where the vectors are created.
+     * @param numOfFrames the number of frames stored in the vectors.
+     */
+    void createOutputVectors(Result &result, int numOfFrames);
+
+    /**
+     * @brief Resets the histogram buffers to zero.
+     * 
+     * @param set the buffer set with the histogram buffers.
+     */
+    void resetHistBuffers(BufferSet &set);
+
+    /**
+     * @brief Creates the ring of buffer sets used by submit.
+     * 
+     */
+    void createRing();
+
+    /**
+     * @brief Releases the ring of buffer sets used by submit, after the frames still being read back to the host memory of their futures.
+     * 
+     */
+    void clearRing();
+
+    /**
+     * @brief Splits tightly packed raw image data into its planes.
+     * 
+     * @param ptr pointer to memory that contains the raw image data.
+     * @return std::vector<Plane> with the planes of the image.
+     */
+    std::vector<Plane> tightPlanes(const void *ptr);
+
+    /**
+     * @brief Write the input memory buffers of a buffer set with the planes of the raw image data.
+     * 
+     * @param set the buffer set to be written.
+     * @param planes the planes of the raw image data, stored as the input type.
+     * @param blockRows the number of block rows calculated on the device, only the rows of the planes they cover are uploaded.
+     */
+    void writeInputBuffers(BufferSet &set, const std::vector<Plane> &planes, int blockRows);
+
+    /**
+     * @brief Gets the number of rows of a plane covered by the first block rows.
+     * 
+     * @param plane the index of the plane.
+     * @param blockRows the number of block rows.
+     * @return int with the number of rows.
+     */
+    int planeRows(int plane, int blockRows);
+
+    /**
+     * @brief Write the input memory buffers of a buffer set with a batch of tightly packed frames stored back to back.
+     * 
+     * @param set the buffer set to be written, created for the number of frames of the batch.
+     * @param ptr pointer to memory that contains the raw image data of the frames.
+     */
+    void writeBatchBuffers(BufferSet &set, const void *ptr);
+
+    /**
+     * @brief Write the number of bins and the format descriptor of tightly packed planes stored back to back to a buffer set.
+     * 
+     * @param set the buffer set to be written.
+     */
+    void writeTightFormat(BufferSet &set);
+
+    /**
+     * @brief Unmaps the input memory buffer of the environment if it was mapped with mapInputBuffer.
+     */
+    void unmapInputBuffer();
+
+    /**
+     * @brief Unmaps the output memory buffer of a buffer set if its outputs were mapped to be read.
+     * 
+     * @param set the buffer set.
+     */
+    void unmapOutputBuffer(BufferSet &set);
+
+    /**
+     * @brief Selects the kernel for the color and detail options and sets its arguments to the buffers of a buffer set.
+     * 
+     * @param set the buffer set used by the kernel.
+     * @param detail the option to perform calculations with our without returning the details.
+     * @return cl::Kernel ready to be enqueued.
+     */
+    cl::Kernel setKernelArgs(BufferSet &set, Detail detail);
+
+    /**
+     * @brief Applies the tuned launch configuration of the environment from the tuning file, or tunes it and stores it if the file does not have it.
+     * 
+     */
+    void tuneConfiguration();
+
+    /**
+     * @brief Measures the time of the kernels of the current configuration on a frame, the best of several runs.
+     * 
+     * @param planes the planes of the frame, stored as the input type.
+     * @return double with the time in milliseconds, the largest double if the kernels cannot be launched.
+     */
+    double benchmarkConfiguration(const std::vector<Plane> &planes);
+
+    /**
+     * @brief Helper function used to get the key of the tuning file, the device and the configuration that the tuned values are valid for.
+     * 
+     * @return std::string with the key of the configuration.
+     */
+    std::string tuningKey();
+
+    /**
+     * @brief Reads the entries of the tuning file.
+     * 
+     * @return std::map with the tuned values of each key.
+     */
+    std::map<std::string, std::string> readTuningFile();
+
+    /**
+     * @brief Writes the entries of the tuning file, replacing it.
+     * 
+     * @param entries the tuned values of each key.
+     */
+    void writeTuningFile(const std::map<std::string, std::string> &entries);
+
+    /**
+     * @brief Creates the scratch buffers of the two stage reduction if the number of work groups has changed.
+     * 
+     * @param set the buffer set where the buffers are created.
+     */
+    void createPartialBuffers(BufferSet &set);
+
+    /**
+     * @brief Enqueues the second stage of the histograms of a buffer set, the conversion of the fixed point variance histograms to float or the reduction of the partial histograms of the work groups.
+     * 
+     * @param set the buffer set with the histograms.
+     * @param blockRows the number of block rows of each frame calculated by the launch.
+     */
+    void finishHistograms(BufferSet &set, int blockRows);
+
+    /**
+     * @brief Enqueues the addition of the histograms of a buffer set to the totals accumulated across frames.
+     * 
+     * @param set the buffer set with the histograms of a frame.
+     */
+    void accumulateHistograms(BufferSet &set);
+
+    /**
+     * @brief Reads a histogram of the totals accumulated across frames.
+     * 
+     * @param channel the channel of the histogram.
+     * @param variance the option to read the fixed point variance histogram instead of the average one.
+     * @return std::vector<cl_ulong> with the histogram.
+     */
+    std::vector<cl_ulong> readAccumulation(Channel channel, bool variance);
+
+    /**
+     * @brief Reads the output memory buffers of a buffer set and waits for them.
+     * The outputs are read with a single transfer to the host memory of the buffer set, or to the memory registered by the caller for the outputs of the environment, which are viewed in place, any other result gets a copy of them.
+     * 
+     * @param set the buffer set to be read, of a single frame.
+     * @param detail the option to read the details.
+     * @param result the result where the data is stored.
+     */
+    void readOutputBuffers(BufferSet &set, Detail detail, Result &result);
+
+    /**
+     * @brief Enqueues the read back of the output memory buffers of a buffer set as a single non blocking transfer, without waiting for it.
+     * 
+     * @param set the buffer set to be read.
+     * @param detail the option to read the details.
+     * @param ptr the host memory where the outputs are read, of outputReadSize bytes.
+     * @param event event of the read.
+     */
+    void readOutputBuffers(BufferSet &set, Detail detail, void *ptr, cl::Event *event);
+
+    /**
+     * @brief Gets the number of bytes at the start of the output buffer of a buffer set that hold the requested outputs.
+     * 
+     * @param layout the layout of the output buffer.
+     * @param detail the option to read the details.
+     * @return size_t with the number of bytes.
+     */
+    size_t outputReadSize(const OutputLayout &layout, Detail detail);
+
+    /**
+     * @brief Gets a view of an output of the environment, in the host memory the frame was read to if it was read back from the device.
+     * 
+     * @param values the vector of the output in the result of the environment.
+     * @param offset the offset of the output in the output buffer.
+     * @return View<T> of the output.
+     */
+    template <typename T>
+    View<T> outputView(const std::vector<T> &values, size_t offset);
+
+    /**
+     * @brief Reads the requested outputs of a buffer set to the host.
+     * With zero copy buffers the output buffer is mapped, unless the outputs are read to the given memory, otherwise they are read with a single transfer.
+     * 
+     * @param set the buffer set to be read.
+     * @param detail the option to read the details.
+     * @param ptr the host memory where the outputs are read, of the size of the output buffer, or NULL to use the host memory of the buffer set.
+     * @param event event of the read, which the caller waits for before using the outputs, or NULL to wait for it before returning.
+     * @return const char* with the outputs, laid out as the output buffer, or NULL if they could not be read.
+     */
+    const char *fetchOutputs(BufferSet &set, Detail detail, char *ptr, cl::Event *event);
+
+    /**
+     * @brief Copies the outputs of a frame from the host memory they were read to into a result.
+     * The vectors of the result are only allocated when their size changes, the histograms of the channels that are not calculated are cleared.
+     * 
+     * @param layout the layout of the output buffer that was read.
+     * @param data the host memory the outputs were read to.
+     * @param numOfChannels the number of channels calculated.
+     * @param detail the option to copy the details.
+     * @param result the result where the data is stored.
+     * @param frame the index of the frame in the outputs.
+     */
+    static void unpackOutputs(const OutputLayout &layout, const char *data, int numOfChannels, Detail detail, Result &result, int frame);
+
+    /**
+     * @brief Helper function used to copy an output of a frame from the host memory of the outputs.
+     * 
+     * @param data the host memory the outputs were read to.
+     * @param offset the offset of the output in the output buffer.
+     * @param frame the index of the frame.
+     * @param size the size of the output of a frame.
+     * @param values the vector where the output is stored.
+     */
+    template <typename T>
+    static void frameCopy(const char *data, size_t offset, int frame, int size, std::vector<T> &values) {
+        const T *first = reinterpret_cast<const T *>(data + offset) + (size_t)frame * size;
+        values.resize(size);
+        std::copy(first, first + size, values.begin());
+    }
+
+    /**
+     * @brief Writes host memory to a buffer, waiting for the write.
+     * 
+     * @param queue the queue where the write is enqueued.
+     * @param buffer the buffer to be written.
+     * @param offset the offset in bytes in the buffer.
+     * @param size the size in bytes of the data.
+     * @param ptr pointer to the data.
+     * @param name the name of the buffer for the error messages.
+     */
+    void writeBuffer(cl::CommandQueue &queue, cl::Buffer &buffer, size_t offset, size_t size, const void *ptr, std::string name);
+
+    /**
+     * @brief Helper function used to add the allocation flags of the memory mode to the flags of a buffer.
+     * 
+     * @param flags the access flags of the buffer.
+     * @return cl_mem_flags with the flags used to create the buffer.
+     */
+    cl_mem_flags memoryFlags(cl_mem_flags flags);
+
+    /**
+     * @brief Helper function used to get the number of blocks along a dimension of the image, according to the edge policy.
+     *
+     * @param dimension image dimension to be used.
+     * @param blockDimension block dimension to be compared to
+     * @return int with the number of blocks.
+     */
+    int numOfBlocks(int dimension, int blockDimension);
+
+    /**
+     * @brief Helper function used to check if the sum of squares of an 8 bit block needs 64 bit accumulators.
+     *
+     * @return true if the block holds more than 33025 pixels of 8 bit samples.
+     */
+    bool wideAccumulators();
+
+    /**
+     * @brief Helper function used to check if the variance of a block can be calculated without overflowing the accumulators.
+     *
+     * @param blockWidth block width to be checked.
+     * @param blockHeight block height to be checked.
+     * @return true if the block size is valid for the bit depth.
+     */
+    bool validBlockSize(int blockWidth, int blockHeight);
+
+    /**
+     * @brief Helper function used to get the bit depth of the samples for the image format.
+     * 
+     * @return int with the bit depth.
+     */
+    int bitDepth();
+
+    /**
+     * @brief Helper function used to get the shift that aligns the samples of the image format to the least significant bit.
+     * 
+     * @return int with the shift.
+     */
+    int sampleShift();
+
+    /**
+     * @brief Helper function used to get the horizontal chroma subsampling of the image format.
+     * 
+     * @return int with the subsampling (1 or 2).
+     */
+    int chromaSubsamplingX();
+
+    /**
+     * @brief Helper function used to get the vertical chroma subsampling of the image format.
+     * 
+     * @return int with the subsampling (1 or 2).
+     */
+    int chromaSubsamplingY();
+
+    /**
+     * @brief Helper function used to get the width of the chroma channels, rounded up for odd image widths.
+     * 
+     * @return int with the chroma width.
+     */
+    int chromaWidth();
+
+    /**
+     * @brief Helper function used to get the height of the chroma channels, rounded up for odd image heights.
+     * 
+     * @return int with the chroma height.
+     */
+    int chromaHeight();
+
+    /**
+     * @brief Helper function used to get the number of planes of the image format.
+     * 
+     * @return int with the number of planes.
+     */
+    int numOfPlanes();
+
+    /**
+     * @brief Helper function used to get the distance in samples between two luma samples of a row.
+     * 
+     * @return int with the pixel stride (2 for packed formats, 1 otherwise).
+     */
+    int lumaPixelStride();
+
+    /**
+     * @brief Helper function used to get the distance in samples between two samples of a row of a chroma channel.
+     * 
+     * @return int with the pixel stride (4 for packed formats, 2 for semi-planar formats, 1 otherwise).
+     */
+    int chromaPixelStride();
+
+    /**
+     * @brief Helper function used to get the width of a row of a plane in samples.
+     * 
+     * @param plane the index of the plane.
+     * @return int with the row width.
+     */
+    int planeWidth(int plane);
+
+    /**
+     * @brief Helper function used to get the number of rows of a plane.
+     * 
+     * @param plane the index of the plane.
+     * @return int with the number of rows.
+     */
+    int planeHeight(int plane);
+
+    /**
+     * @brief Calculates the format descriptor that gives the kernels the layout of each channel in the raw image data.
+     * 
+     * @param planeOffsets the position of the first sample of each plane in the image buffer.
+     * @param rowStrides the distance in samples between the start of two consecutive rows of each plane.
+     */
+    void calculateFormatDescriptor(const std::vector<int> &planeOffsets, const std::vector<int> &rowStrides);
+
+    /**
+     * @brief Calculates the fields of the format descriptor given by the geometry of the blocks and of the launch.
+     * 
+     * @param descriptor the format descriptor where the fields are written.
+     */
+    void calculateBlockFields(std::vector<int> &descriptor);
+
+    /**
+     * @brief Uploads the format descriptor of a buffer set again if the geometry of the blocks has changed since its image was uploaded.
+     * 
+     * @param set the buffer set with the format descriptor.
+     */
+    void updateFormatDescriptor(BufferSet &set);
+
+    /**
+     * @brief Helper function used to generate the options used to build the kernel program.
+     * 
+     * @return std::string with the build options.
+     */
+    std::string buildOptions();
+
+    /**
+     * @brief Helper function used to load the kernels specialized for the current configuration.
+     * The setters only mark the kernels as stale, they are loaded by the next calculation.
+     * The programs are cached by their build options, so only the first use of a configuration builds a program.
+     * If the kernels cannot be launched with the chosen work group size, the sizes are recalculated with a smaller one.
+     */
+    void loadKernels();
+
+    /**
+     * @brief Helper function used to get the path of the cached binary of a program.
+     * 
+     * @param options the build options of the program.
+     * @return std::string with the path in the cache directory.
+     */
+    std::string binaryPath(const std::string &options);
+
+    /**
+     * @brief Helper function used to load a program from its cached binary.
+     * 
+     * @param options the build options of the program.
+     * @return cl::Program built from the binary, or an empty program if there is no usable binary in the cache.
+     */
+    cl::Program readProgramBinary(const std::string &options);
+
+    /**
+     * @brief Helper function used to store the binary of a built program in the cache directory.
+     * 
+     * @param program the built program.
+     * @param options the build options of the program.
+     */
+    void writeProgramBinary(cl::Program &program, const std::string &options);
+
+    /**
+     * @brief Fields of the format descriptor, must match the FORMAT_ defines of the kernel files.
+     * Each channel is described by its offset, pixel stride and row stride (in samples) and its width and height, followed by the chroma subsampling, the edge policy, the distance in samples between the frames of a batch, the number of blocks of the image in each dimension, the size of the luma blocks and the geometry of the work groups.
+     */
+    enum FormatField {
+        YOffset,
+        YPixelStride,
+        YRowStride,
+        YWidth,
+        YHeight,
+        UOffset,
+        UPixelStride,
+        URowStride,
+        UWidth,
+        UHeight,
+        VOffset,
+        VPixelStride,
+        VRowStride,
+        VWidth,
+        VHeight,
+        ChromaSubsamplingX,
+        ChromaSubsamplingY,
+        EdgePolicy,
+        FrameStride,
+        NumOfBlocksX,
+        NumOfBlocksY,
+        BlockWidth,
+        BlockHeight,
+        BlocksPerGroup,
+        ItemsPerBlock,
+        FormatFieldCount
+    };
+
+    // Control
+    bool environmentSetUp = false;
+    bool kernelsLoaded = false;
+
+    // Image and Block
+    int imgWidth;
+    int imgHeight;
+    int blockWidth;
+    int blockHeight;
+    int numOfBins;
+    Format format;
+    Color color;
+    Input input = Input::Int;
+    Edge edge = Edge::Discard;
+    Memory memory = Memory::Auto;
+    Reduction reduction = Reduction::Atomic;
+    Accumulation accumulation = Accumulation::Frame;
+    Backend backend = Backend::Auto;
+    bool cpuBackend = false;
+    bool hybridBackend = false;
+    int threads = 0;
+
+    // Worker threads of the CPU backend, not copied with the settings
+    std::unique_ptr<WorkerPool> workers;
+
+    // Hybrid Split, the block rows calculated by the device and the time per block row of each side
+    int deviceRows = 0;
+    double deviceRowTime = 0;
+    double cpuRowTime = 0;
+
+    // Adaptive Dispatch, the time of a frame on each backend for every configuration, smoothed over the frames
+    struct DispatchCost {
+        double deviceTime = 0;
+        double cpuTime = 0;
+        int frames = 0;
+    };
+    bool adaptiveBackend = false;
+    Backend lastBackend = Backend::OpenCL;
+    std::map<std::string, DispatchCost> dispatchCosts;
+    bool zeroCopy = false;
+
+    // Channel Details
+    int ySize;
+    int uSize;
+    int vSize;
+    int imageSize;
+    std::vector<int> formatDescriptor;
+    size_t sampleSize;
+    size_t accumulatorSize;
+
+    int yBlockWidth;
+    int yBlockHeight;
+    int yBlockSize;
+    int yNumOfBlocks;
+
+    int uBlockWidth;
+    int uBlockHeight;
+    int uBlockSize;
+    int uNumOfBlocks;
+
+    int vBlockWidth; 
+    int vBlockHeight;
+    int vBlockSize;
+    int vNumOfBlocks;
+
+    int numOfBlocksX;
+    int numOfBlocksY;
+    int blocksPerGroup = 8;
+
+    // Work Group Geometry
+    int workGroupSize = 0;
+    int pixelsPerItem = 4;
+    int maxWorkGroupSize = 256;
+    int reduceWorkGroupSize = 1;
+    int localSize;
+    int itemsPerBlock;
+    int groupBlocks;
+    bool subGroupReduce = false;
+    bool workGroupReduce = false;
+    bool int64Atomics = false;
+
+    // Error
+    bool showErrors = false;
+    int clError;
+    int histError;
+
+    // Platform Devices Queue
+    std::string platformName;
+    DeviceType deviceType = DeviceType::GPU;
+    std::string deviceName;
+    int deviceIndex = 0;
+    int subDeviceUnits = 0;
+    int subDeviceIndex = 0;
+    cl::Platform platform;
+    std::vector<cl::Device> devices;
+    cl::Device defaultDevice;
+    cl::Program program;
+    cl::Context context;
+
+    // Programs built for each configuration, keyed by their build options
+    std::string sourceCode;
+    std::map<std::string, cl::Program> programs;
+    std::string cacheDirectory;
+    std::string tuningFile;
+
+    // Kernels
+    cl::Kernel histogramsKernel;
+    cl::Kernel histogramsDetailKernel;
+    cl::Kernel singleChannelKernel;
+    cl::Kernel singleChannelDetailKernel;
+    cl::Kernel convertKernel;
+    cl::Kernel reduceKernel;
+    cl::Kernel accumulateKernel;
+
+    // Ranges
+    cl::NDRange globalRange;
+    cl::NDRange localRange;
+    cl::Event event;
+
+    // Host Image (CPU backend), the planes are cleared when the format or the image size change
+    std::vector<uint8_t> hostImage;
+    std::vector<Plane> hostPlanes;
+    std::vector<int> hostGeometry;
+    void *mappedImage = NULL;
+
+    // Buffers
+    BufferSet buffers;
+    std::vector<BufferSet> ring;
+    int ringIndex = 0;
+    int inFlightFrames = 3;
+    BufferSet batch;
+
+    // Totals accumulated across frames, the average histogram followed by the fixed point variance histogram of every channel
+    cl::Buffer totalBuffer;
+    std::vector<cl_ulong> hostTotals;
+    int accumulatedFrames = 0;
 
-    // Input Buffers
-    cl::Buffer imageBuffer;
-    cl::Buffer numOfBinsBuffer;
-    cl::Buffer formatBuffer;
-
-    // Output Buffers
-    cl::Buffer yAverageBuffer;
-    cl::Buffer uAverageBuffer;
-    cl::Buffer vAverageBuffer;
-    cl::Buffer yVarianceBuffer;
-    cl::Buffer uVarianceBuffer;
-    cl::Buffer vVarianceBuffer;
-    cl::Buffer yAverageHistBuffer;
-    cl::Buffer uAverageHistBuffer;
-    cl::Buffer vAverageHistBuffer;
-    cl::Buffer yVarianceHistBuffer;
-    cl::Buffer uVarianceHistBuffer;
-    cl::Buffer vVarianceHistBuffer;
-
-    // Output Vectors
-    std::vector<float> yAverage;
-    std::vector<float> uAverage;
-    std::vector<float> vAverage;
-    std::vector<float> yVariance;
-    std::vector<float> uVariance;
-    std::vector<float> vVariance;
-    std::vector<int> yAverageBins;
-    std::vector<int> uAverageBins;
-    std::vector<int> vAverageBins;
-    std::vector<varhist> yVarianceBins;
-    std::vector<varhist> uVarianceBins;
-    std::vector<varhist> vVarianceBins;
+    // Output, the frames read back from the device stay in the host memory they were read to, of the output buffer or registered by the caller
+    Result output;
+    const char *fusedOutput = NULL;
+    void *outputMemory = NULL;
+    size_t outputMemorySize = 0;
 
     // Timers
-    double elapsedTime;
+    double elapsedTime = 0;
 };
\ No newline at end of file
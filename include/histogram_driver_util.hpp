@@ -4,8 +4,13 @@
 #include <cmath>
 #include <stdlib.h>
 #include <iostream>
+#include <iomanip>
 #include <chrono>
 #include <string>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
 
 class TimeInterval
 {
@@ -42,117 +47,81 @@ int adjustDimension(int dimension, int blockDimension) {
     return dimension - (dimension % blockDimension);
 }
 
-void calculateAverage(std::vector<int> imageVector, int globalOffset, int imageWidth, int numOfBlocks, int blockSize, int blockWidth, int blockHeight, std::vector<double> &average) {
-    int x = 0; //X COORD
-    int y = 0; //Y COORD
-    for (int block = 0; block < numOfBlocks; block++) {
-        int i = 0; //ROW (Y)
-        int j = 0; //COL (X)
-        int offset = x + y * imageWidth + globalOffset;
-        int blocksum = 0;
-        for (int pixel = 0; pixel < blockSize; pixel++) {
-            blocksum += imageVector[i * imageWidth + j + offset];
-            j++;
-            if (j == blockWidth) {
-                j = 0;
-                i++;
-            }
-        }
-        average[block] = (double)blocksum / blockSize;
-        x += blockWidth;
-        if (x + blockWidth > imageWidth) {
-            x = 0;
-            y += blockHeight;
-        }
-    }
-}
+// Sums of the samples of each column of a block row, vectorized by the compiler, 8 bit samples fit in 32 bit sums
+template <typename T>
+using ColumnSum = typename std::conditional<std::is_same<T, uint8_t>::value, int, long long>::type;
 
-void calculateVariance(std::vector<int> imageVector, int globalOffset, int imageWidth, int numOfBlocks, int blockSize, int blockWidth, int blockHeight, std::vector<double> average, std::vector<double> &variance) {
-    int x = 0; //X COORD
-    int y = 0; //Y COORD
-    for (int block = 0; block < numOfBlocks; block++) {
-        int i = 0; //ROW (Y)
-        int j = 0; //COL (X)
-        int offset = x + y * imageWidth + globalOffset;
-        double variancesum = 0;
-        for (int pixel = 0; pixel < blockSize; pixel++) {
-            int val = imageVector[i * imageWidth + j + offset];
-            double var = std::pow((val - average[block]), 2);
-            variancesum += var;
-            j++;
-            if (j == blockWidth) {
-                j = 0;
-                i++;
-            }
-        }
-        variance[block] = (double)variancesum / blockSize;
-        x += blockWidth;
-        if (x + blockWidth > imageWidth) {
-            x = 0;
-            y += blockHeight;
-        }
+template <typename T>
+void calculateAverageAndVariance(const std::vector<T> &imageVector, int globalOffset, int imageWidth, int numOfBlocks, int blockSize, int blockWidth, int blockHeight, std::vector<double> &average, std::vector<double> &variance, int numOfThreads = 0) {
+    int blocksPerRow = imageWidth / blockWidth;
+    int numOfBlockRows = numOfBlocks / blocksPerRow;
+    if (numOfThreads <= 0) {
+        numOfThreads = std::max((int)std::thread::hardware_concurrency(), 1);
     }
-}
+    numOfThreads = std::max(std::min(numOfThreads, numOfBlockRows), 1);
 
-void calculateAverageAndVariance(std::vector<int> imageVector, int globalOffset, int imageWidth, int numOfBlocks, int blockSize, int blockWidth, int blockHeight, std::vector<double> &average, std::vector<double> &variance) {
-    int x = 0; //X COORD
-    int y = 0; //Y COORD
-    for (int block = 0; block < numOfBlocks; block++) {
-        int i = 0; //ROW (Y)
-        int j = 0; //COL (X)
-        int offset = x + y * imageWidth + globalOffset;
-        int blocksum = 0;
-        for (int pixel = 0; pixel < blockSize; pixel++) {
-            blocksum += imageVector[i * imageWidth + j + offset];
-            j++;
-            if (j == blockWidth) {
-                j = 0;
-                i++;
+    // Every thread calculates a range of block rows in a single pass, with the sum and the sum of squares of each block
+    auto calculateRows = [&](int thread) {
+        std::vector<ColumnSum<T>> sums(imageWidth);
+        std::vector<ColumnSum<T>> squares(imageWidth);
+        int firstRow = (int)((long long)numOfBlockRows * thread / numOfThreads);
+        int lastRow = (int)((long long)numOfBlockRows * (thread + 1) / numOfThreads);
+        for (int blockRow = firstRow; blockRow < lastRow; blockRow++) {
+            std::fill(sums.begin(), sums.end(), 0);
+            std::fill(squares.begin(), squares.end(), 0);
+            for (int i = 0; i < blockHeight; i++) {
+                const T *row = &imageVector[globalOffset + (size_t)(blockRow * blockHeight + i) * imageWidth];
+                for (int j = 0; j < imageWidth; j++) {
+                    ColumnSum<T> val = row[j];
+                    sums[j] += val;
+                    squares[j] += val * val;
+                }
             }
-        }
-        average[block] = (double)blocksum / blockSize;
-        double variancesum = 0;
-        i = 0;
-        j = 0;
-        for (int pixel = 0; pixel < blockSize; pixel++) {
-            int val = imageVector[i * imageWidth + j + offset];
-            double var = std::pow((val - average[block]), 2);
-            variancesum += var;
-            j++;
-            if (j == blockWidth) {
-                j = 0;
-                i++;
+            for (int blockX = 0; blockX < blocksPerRow; blockX++) {
+                long long blocksum = 0;
+                long long squaresum = 0;
+                for (int j = blockX * blockWidth; j < (blockX + 1) * blockWidth; j++) {
+                    blocksum += sums[j];
+                    squaresum += squares[j];
+                }
+                // Exact in integers, so the variance is only rounded once
+                int block = blockRow * blocksPerRow + blockX;
+                average[block] = (double)blocksum / blockSize;
+                variance[block] = (double)(squaresum * blockSize - blocksum * blocksum) / ((double)blockSize * blockSize);
             }
         }
-        variance[block] = (double)variancesum / blockSize;
-        x += blockWidth;
-        if (x + blockWidth > imageWidth) {
-            x = 0;
-            y += blockHeight;
-        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int thread = 1; thread < numOfThreads; thread++) {
+        workers.emplace_back(calculateRows, thread);
+    }
+    calculateRows(0);
+    for (std::thread &worker : workers) {
+        worker.join();
     }
 }
 
-void calculateHistogram(std::vector<double> input, int numOfBins, std::vector<int> &bins) {
+void calculateHistogram(const std::vector<double> &input, int numOfBins, std::vector<int> &bins) {
     int binSize = 256/numOfBins;
 
-    for (int i = 0; i < input.size(); i++) {
+    for (size_t i = 0; i < input.size(); i++) {
         int interval = input[i]/binSize;
         bins[interval]++;
     }
 }
 
-void calculateHistogram(std::vector<double> input, int numOfBins, std::vector<double> &bins, std::vector<double> increment) {
+void calculateHistogram(const std::vector<double> &input, int numOfBins, std::vector<double> &bins, const std::vector<double> &increment) {
     int binSize = 256/numOfBins;
 
-    for (int i = 0; i < input.size(); i++) {
+    for (size_t i = 0; i < input.size(); i++) {
         int interval = input[i]/binSize;
         bins[interval] += increment[i];
     }
 }
 
 template <typename T>
-bool validateVector(std::vector<T> input, std::vector<T> validatingVector) {
+bool validateVector(const std::vector<T> &input, const std::vector<T> &validatingVector) {
     bool result = false;
     for (int i = 0; i < input.size(); i++) {
         if (input[i] != validatingVector[i]){
@@ -166,7 +135,7 @@ bool validateVector(std::vector<T> input, std::vector<T> validatingVector) {
 }
 
 template <typename T, typename U>
-void validateVectorError(std::vector<T> input, std::vector<U> validatingVector) {
+void validateVectorError(const std::vector<T> &input, const std::vector<U> &validatingVector) {
     double sum = 0;
     for (int i = 0; i < input.size(); i++) {
         if (validatingVector[i] != 0) {
@@ -1,21 +1,13 @@
 #pragma once
 
 #include "histogram.hpp"
+#include "histogram_kernels.hpp"
 
-Histogram::Histogram() {
-    imgWidth = 1920;
-    imgHeight = 1080;
-    blockWidth = 8;
-    blockHeight = 8;
-    numOfBins = 16;
-    format = Format::YUV;
-    color = Color::Chromatic;
-    showErrors = false;
-    elapsedTime = 0;
-    environmentSetUp = false;
-}
+Histogram::Histogram() : Histogram(Format::YUV, Color::Chromatic, 1920, 1080, 8, 8, 16) {}
 
-Histogram::Histogram(Format format, Color color, int imgWidth, int imgHeight, int blockWidth, int blockHeight, int numOfBins) {
+Histogram::Histogram(Format format, Color color, int imgWidth, int imgHeight, int blockWidth, int blockHeight, int numOfBins) : Histogram(format, color, Input::Int, imgWidth, imgHeight, blockWidth, blockHeight, numOfBins) {}
+
+Histogram::Histogram(Format format, Color color, Input input, int imgWidth, int imgHeight, int blockWidth, int blockHeight, int numOfBins) {
     this->imgWidth = imgWidth;
     this->imgHeight = imgHeight;
     this->blockWidth = blockWidth;
@@ -23,31 +15,81 @@ Histogram::Histogram(Format format, Color color, int imgWidth, int imgHeight, in
     this->numOfBins = numOfBins;
     this->format = format;
     this->color = color;
-    elapsedTime = 0;
-    showErrors = false;
-    environmentSetUp = false;
-}
-
-Histogram::Histogram(const Histogram &o) {
-    imgWidth = o.imgWidth;
-    imgHeight = o.imgHeight;
-    blockWidth = o.blockWidth;
-    blockHeight = o.blockHeight;
-    numOfBins = o.numOfBins;
-    format = o.format;
-    color = o.color;
-    elapsedTime = 0;
+    this->input = input;
+}
+
+Histogram::Histogram(const Histogram &o) : Histogram(o.format, o.color, o.input, o.imgWidth, o.imgHeight, o.blockWidth, o.blockHeight, o.numOfBins) {
+    // Only the settings are copied, the copy sets up its own environment
+    edge = o.edge;
+    memory = o.memory;
+    reduction = o.reduction;
+    accumulation = o.accumulation;
+    backend = o.backend;
+    threads = o.threads;
+    platformName = o.platformName;
+    deviceType = o.deviceType;
+    deviceName = o.deviceName;
+    deviceIndex = o.deviceIndex;
+    subDeviceUnits = o.subDeviceUnits;
+    subDeviceIndex = o.subDeviceIndex;
+    inFlightFrames = o.inFlightFrames;
+    blocksPerGroup = o.blocksPerGroup;
+    workGroupSize = o.workGroupSize;
+    pixelsPerItem = o.pixelsPerItem;
+    cacheDirectory = o.cacheDirectory;
+    tuningFile = o.tuningFile;
     showErrors = o.showErrors;
-    environmentSetUp = false;
 }
 
-Histogram::~Histogram() {}
+Histogram::~Histogram() {
+    clearRing();
+    unmapOutputBuffer(buffers);
+}
 
 void Histogram::setupEnvironment() {
+    if (!validBlockSize(blockWidth, blockHeight)) {
+        std::cout << "Environment not set up" << std::endl;
+        return;
+    }
+
     // Get platform and device information
-    platform = cl::Platform::getDefault();
-    platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    defaultDevice = devices[0];
+    bool deviceFound = (backend != Backend::CPU) && selectDevice();
+
+    // The CPU backend is used when asked for or when no OpenCL device matches, it needs no OpenCL objects
+    cpuBackend = (backend == Backend::CPU) || (backend != Backend::OpenCL && !deviceFound);
+    hybridBackend = (backend == Backend::Hybrid) && !cpuBackend;
+    adaptiveBackend = (backend == Backend::Adaptive) && !cpuBackend;
+    dispatchCosts.clear();
+    lastBackend = cpuBackend ? Backend::CPU : (hybridBackend ? Backend::Hybrid : Backend::OpenCL);
+    deviceRows = 0;
+    deviceRowTime = 0;
+    cpuRowTime = 0;
+    if (cpuBackend) {
+        calculateSizes();
+        createOutputVectors(output, 1);
+        resetAccumulation();
+        environmentSetUp = true;
+        return;
+    }
+    if (!deviceFound) {
+        std::cout << "Device ERROR: no matching OpenCL device found" << std::endl;
+        return;
+    }
+
+    // Use zero copy buffers if the device shares its memory with the host, a CPU device or one that can access any host memory
+    // The unified memory query is deprecated (and not exposed by the C++ bindings), it is only asked to tell integrated GPUs apart otherwise
+    bool sharedMemory = false;
+    if (memory == Memory::Auto) {
+        cl_device_svm_capabilities svmCapabilities = 0;
+        defaultDevice.getInfo(CL_DEVICE_SVM_CAPABILITIES, &svmCapabilities);
+        sharedMemory = defaultDevice.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU || (svmCapabilities & CL_DEVICE_SVM_FINE_GRAIN_SYSTEM) != 0;
+    }
+    if (!sharedMemory && memory == Memory::Auto) {
+        cl_bool unifiedMemory = CL_FALSE;
+        clGetDeviceInfo(defaultDevice(), CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unifiedMemory, NULL);
+        sharedMemory = unifiedMemory == CL_TRUE;
+    }
+    zeroCopy = (memory == Memory::ZeroCopy) || sharedMemory;
 
     // Create context
     context = cl::Context(defaultDevice, NULL, NULL, NULL, &clError);
@@ -56,439 +98,1922 @@ void Histogram::setupEnvironment() {
     }
 
     // Create CommandQueue
-    commandQueue = cl::CommandQueue(context, defaultDevice, cl::QueueProperties::Profiling, &clError);
+    buffers.queue = cl::CommandQueue(context, defaultDevice, cl::QueueProperties::Profiling, &clError);
     if (showErrors && clError < 0) {
         std::cout << "Queue ERROR: " << clError << std::endl;
     }
 
-    // Read Program Source
-    std::ifstream sourceFile("histogram_kernel.cl");
-    std::string sourceCode(
-        std::istreambuf_iterator<char>(sourceFile),
-        (std::istreambuf_iterator<char>()));
+    // Reduce the blocks with the collective functions supported by the device
+    subGroupReduce = defaultDevice.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_subgroups") != std::string::npos;
+    workGroupReduce = false;
+    for (const cl_name_version &feature : defaultDevice.getInfo<CL_DEVICE_OPENCL_C_FEATURES>()) {
+        subGroupReduce = subGroupReduce || std::string(feature.name) == "__opencl_c_subgroups";
+        workGroupReduce = workGroupReduce || std::string(feature.name) == "__opencl_c_work_group_collective_functions";
+    }
 
-    // Load Program
-    program = cl::Program(context, sourceCode, clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Program ERROR: " << clError << std::endl;
+    // The fixed point variance histograms use 64 bit atomics when available, and pairs of 32 bit atomics otherwise
+    int64Atomics = defaultDevice.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_int64_base_atomics") != std::string::npos;
+
+    // Program Source, embedded in the library
+    sourceCode = std::string(reinterpret_cast<const char *>(histogramKernel));
+    programs.clear();
+
+    // Largest work group of the device, lowered by loadKernels if the kernels cannot be launched with it
+    maxWorkGroupSize = defaultDevice.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+    calculateSizes();
+    loadKernels();
+    createInputBuffers(buffers);
+    createOutputVectors(output, 1);
+    createOutputBuffers(buffers);
+    createTotalBuffer();
+    resetAccumulation();
+
+    // Launch configuration tuned for the device
+    if (!tuningFile.empty()) {
+        tuneConfiguration();
     }
 
-    // Build Program
-    clError = program.build(defaultDevice, "-cl-std=CL3.0");
-    if (showErrors && clError < 0) {
-        std::cout << "Build Program ERROR: " << clError << std::endl;
-        std::cout << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(defaultDevice) << std::endl;
+    environmentSetUp = true;
+}
+
+bool Histogram::selectDevice() {
+    auto matches = [](std::string text, std::string pattern) {
+        for (char &c : text) {
+            c = (char)std::tolower((unsigned char)c);
+        }
+        for (char &c : pattern) {
+            c = (char)std::tolower((unsigned char)c);
+        }
+        return text.find(pattern) != std::string::npos;
+    };
+
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+    if (deviceType == DeviceType::CPU) {
+        type = CL_DEVICE_TYPE_CPU;
+    }
+    else if (deviceType == DeviceType::Accelerator) {
+        type = CL_DEVICE_TYPE_ACCELERATOR;
+    }
+    else if (deviceType == DeviceType::Any) {
+        type = CL_DEVICE_TYPE_ALL;
+    }
+
+    // Matching devices of every matching platform, in the order of the platforms
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    devices.clear();
+    for (cl::Platform &candidate : platforms) {
+        if (!matches(candidate.getInfo<CL_PLATFORM_NAME>(), platformName) && !matches(candidate.getInfo<CL_PLATFORM_VENDOR>(), platformName)) {
+            continue;
+        }
+        std::vector<cl::Device> platformDevices;
+        candidate.getDevices(type, &platformDevices);
+        for (cl::Device &device : platformDevices) {
+            if (matches(device.getInfo<CL_DEVICE_NAME>(), deviceName) || matches(device.getInfo<CL_DEVICE_VENDOR>(), deviceName)) {
+                devices.push_back(device);
+            }
+        }
+    }
+    if (deviceIndex >= (int)devices.size()) {
+        return false;
     }
+    defaultDevice = devices[deviceIndex];
+    platform = cl::Platform(defaultDevice.getInfo<CL_DEVICE_PLATFORM>(), true);
+
+    // Slice of the compute units of the device, the whole device is used if it cannot be partitioned
+    if (subDeviceUnits > 0) {
+        cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)subDeviceUnits, 0};
+        std::vector<cl::Device> subDevices;
+        clError = defaultDevice.createSubDevices(properties, &subDevices);
+        if (showErrors && clError < 0) {
+            std::cout << "SubDevice ERROR: " << clError << std::endl;
+        }
+        if (clError == CL_SUCCESS && subDeviceIndex < (int)subDevices.size()) {
+            defaultDevice = subDevices[subDeviceIndex];
+        }
+        else if (showErrors && clError == CL_SUCCESS) {
+            std::cout << "SubDevice ERROR: index " << subDeviceIndex << " of " << subDevices.size() << " sub-devices" << std::endl;
+        }
+    }
+    return true;
+}
+
+void Histogram::loadKernels() {
+    // The CPU backend has no kernels
+    if (cpuBackend) {
+        kernelsLoaded = true;
+        return;
+    }
+
+    std::string options = buildOptions();
+    auto cached = programs.find(options);
+    if (cached == programs.end()) {
+        // Programs built by an earlier process are loaded from the cache directory
+        cl::Program specialized = readProgramBinary(options);
+        if (specialized() == NULL) {
+            // Load Program
+            specialized = cl::Program(context, sourceCode, false, &clError);
+            if (showErrors && clError < 0) {
+                std::cout << "Program ERROR: " << clError << std::endl;
+            }
+
+            // Build Program
+            clError = specialized.build(defaultDevice, options.c_str());
+            if (showErrors && clError < 0) {
+                std::cout << "Build Program ERROR: " << clError << std::endl;
+                std::cout << specialized.getBuildInfo<CL_PROGRAM_BUILD_LOG>(defaultDevice) << std::endl;
+            }
+            else if (clError == CL_SUCCESS && !cacheDirectory.empty()) {
+                writeProgramBinary(specialized, options);
+            }
+        }
+        cached = programs.emplace(options, specialized).first;
+    }
+    program = cached->second;
 
     // Load Kernels
     histogramsKernel = cl::Kernel(program, "calculateHistograms");
     histogramsDetailKernel = cl::Kernel(program, "calculateHistogramsWithDetail");
     singleChannelKernel = cl::Kernel(program, "calculateHistogramsSingleChannel");
     singleChannelDetailKernel = cl::Kernel(program, "calculateHistogramsSingleChannelWithDetail");
+    convertKernel = cl::Kernel(program, "convertVarianceHistograms");
+    reduceKernel = cl::Kernel(program, "reduceHistograms");
+    accumulateKernel = cl::Kernel(program, "accumulateHistograms");
+
+    // Largest work group that every kernel can be launched with, the program is specialized again for a smaller one if needed
+    int kernelWorkGroupSize = maxWorkGroupSize;
+    for (cl::Kernel *kernel : {&histogramsKernel, &histogramsDetailKernel, &singleChannelKernel, &singleChannelDetailKernel}) {
+        kernelWorkGroupSize = std::min(kernelWorkGroupSize, (int)kernel->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(defaultDevice));
+    }
+    if (kernelWorkGroupSize > 0 && kernelWorkGroupSize < localSize) {
+        maxWorkGroupSize = kernelWorkGroupSize;
+        calculateSizes();
+        loadKernels();
+        return;
+    }
+    reduceWorkGroupSize = std::min(256, (int)reduceKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(defaultDevice));
+    kernelsLoaded = true;
+}
+
+std::string Histogram::binaryPath(const std::string &options) {
+    // A binary is only valid for the same device, driver, kernel source and build options (FNV-1a hash, stable across processes)
+    std::string key = defaultDevice.getInfo<CL_DEVICE_NAME>() + "\n" + defaultDevice.getInfo<CL_DEVICE_VERSION>() + "\n" + defaultDevice.getInfo<CL_DRIVER_VERSION>() + "\n" + options + "\n" + sourceCode;
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    std::ostringstream name;
+    name << "histogram_" << std::hex << hash << ".bin";
+    return (std::filesystem::path(cacheDirectory) / name.str()).string();
+}
+
+cl::Program Histogram::readProgramBinary(const std::string &options) {
+    if (cacheDirectory.empty()) {
+        return cl::Program();
+    }
+    std::ifstream file(binaryPath(options), std::ios::binary);
+    if (!file) {
+        return cl::Program();
+    }
+    std::vector<unsigned char> binary(
+        (std::istreambuf_iterator<char>(file)),
+        (std::istreambuf_iterator<char>()));
+
+    // A binary rejected by the driver is built again from source and replaced
+    cl::Program cachedProgram = cl::Program(context, {defaultDevice}, cl::Program::Binaries(1, binary), NULL, &clError);
+    if (clError == CL_SUCCESS) {
+        clError = cachedProgram.build(defaultDevice, options.c_str());
+    }
+    if (clError != CL_SUCCESS) {
+        return cl::Program();
+    }
+    return cachedProgram;
+}
+
+void Histogram::writeProgramBinary(cl::Program &program, const std::string &options) {
+    std::vector<std::vector<unsigned char>> binaries = program.getInfo<CL_PROGRAM_BINARIES>(&clError);
+    if (clError < 0 || binaries.empty() || binaries[0].empty()) {
+        if (showErrors) {
+            std::cout << "Program Binary ERROR: " << clError << std::endl;
+        }
+        return;
+    }
+
+    // Written to a temporary file and renamed, so processes starting at the same time never load a partial binary
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    std::string path = binaryPath(options);
+    std::string temporaryPath = path + "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(binaries[0].data()), binaries[0].size());
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        if (showErrors) {
+            std::cout << "Program Cache ERROR: could not write " << path << std::endl;
+        }
+    }
+}
+
+void Histogram::tuneConfiguration() {
+    std::map<std::string, std::string> entries = readTuningFile();
+    std::string key = tuningKey();
+
+    // Values tuned by an earlier process, only used if the whole entry is valid, otherwise it is tuned again
+    auto entry = entries.find(key);
+    if (entry != entries.end()) {
+        std::istringstream values(entry->second);
+        int tunedWorkGroupSize, tunedPixelsPerItem, tunedBlocksPerGroup, tunedReduction;
+        std::string rest;
+        bool valid = (values >> tunedWorkGroupSize >> tunedPixelsPerItem >> tunedBlocksPerGroup >> tunedReduction) && !(values >> rest);
+        valid = valid && tunedWorkGroupSize >= 0 && tunedWorkGroupSize <= maxWorkGroupSize && tunedPixelsPerItem >= 1 && tunedBlocksPerGroup >= 1;
+        valid = valid && (tunedReduction == static_cast<int>(Reduction::Atomic) || tunedReduction == static_cast<int>(Reduction::TwoStage));
+        if (valid) {
+            workGroupSize = tunedWorkGroupSize;
+            pixelsPerItem = tunedPixelsPerItem;
+            blocksPerGroup = tunedBlocksPerGroup;
+            reduction = static_cast<Reduction>(tunedReduction);
+            calculateSizes();
+            loadKernels();
+            return;
+        }
+        if (showErrors) {
+            std::cout << "Tuning ERROR: invalid entry for " << key << std::endl;
+        }
+    }
+
+    // Synthetic frame with samples spread over every bin, the same one on every run
+    std::vector<uint8_t> frame(imageSize * sampleSize);
+    std::mt19937 generator(1);
+    for (int sample = 0; sample < imageSize; sample++) {
+        int value = (int)(generator() % (1u << bitDepth())) << sampleShift();
+        if (sampleSize == 1) {
+            frame[sample] = (uint8_t)value;
+        }
+        else if (sampleSize == 2) {
+            uint16_t word = (uint16_t)value;
+            std::memcpy(&frame[sample * 2], &word, sizeof(uint16_t));
+        }
+        else {
+            std::memcpy(&frame[sample * sampleSize], &value, sizeof(int));
+        }
+    }
+    std::vector<Plane> planes = tightPlanes(frame.data());
 
+    // Tune one parameter at a time, a value is only kept if it is faster than the best so far
+    double bestTime = benchmarkConfiguration(planes);
+    Reduction bestReduction = reduction;
+    for (Reduction candidate : {Reduction::Atomic, Reduction::TwoStage}) {
+        reduction = candidate;
+        double time = benchmarkConfiguration(planes);
+        if (time < bestTime) {
+            bestTime = time;
+            bestReduction = candidate;
+        }
+    }
+    reduction = bestReduction;
+
+    auto tune = [&](int &parameter, const std::vector<int> &values) {
+        int bestValue = parameter;
+        for (int value : values) {
+            parameter = value;
+            double time = benchmarkConfiguration(planes);
+            if (time < bestTime) {
+                bestTime = time;
+                bestValue = value;
+            }
+        }
+        parameter = bestValue;
+    };
+    std::vector<int> workGroupSizes;
+    for (int size = 32; size <= maxWorkGroupSize; size *= 2) {
+        workGroupSizes.push_back(size);
+    }
+    tune(workGroupSize, workGroupSizes);
+    tune(pixelsPerItem, {1, 2, 4, 8, 16});
+    tune(blocksPerGroup, {1, 2, 4, 8, 16, 32});
+
+    // Keep the winner, and clear the histograms of the runs
     calculateSizes();
-    createInputBuffers();
-    createOutputVectors();
-    createOutputBuffers();
+    loadKernels();
+    resetHistBuffers(buffers);
 
-    environmentSetUp = true;
+    entries[key] = std::to_string(workGroupSize) + " " + std::to_string(pixelsPerItem) + " " + std::to_string(blocksPerGroup) + " " + std::to_string(static_cast<int>(reduction));
+    writeTuningFile(entries);
+}
+
+double Histogram::benchmarkConfiguration(const std::vector<Plane> &planes) {
+    calculateSizes();
+    loadKernels();
+    writeInputBuffers(buffers, planes, numOfBlocksY);
+
+    // The first run allocates the scratch buffers of the configuration and is not counted
+    double bestTime = std::numeric_limits<double>::max();
+    for (int run = 0; run < 6; run++) {
+        buffers.queue.finish();
+        auto start = std::chrono::steady_clock::now();
+        cl::Kernel kernel = setKernelArgs(buffers, Detail::Exclude);
+        clError = buffers.queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange, NULL, NULL);
+        if (clError < 0) {
+            return std::numeric_limits<double>::max();
+        }
+        finishHistograms(buffers, numOfBlocksY);
+        buffers.queue.finish();
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run > 0) {
+            bestTime = std::min(bestTime, time);
+        }
+    }
+    return bestTime;
+}
+
+std::string Histogram::tuningKey() {
+    // The tuned values are only valid for the same device, driver and configuration
+    std::ostringstream key;
+    key << defaultDevice.getInfo<CL_DEVICE_NAME>() << ";" << defaultDevice.getInfo<CL_DRIVER_VERSION>() << ";" << defaultDevice.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() << " units";
+    key << ";format " << static_cast<int>(format) << ";input " << static_cast<int>(input) << ";color " << static_cast<int>(color);
+    key << ";" << imgWidth << "x" << imgHeight << ";block " << blockWidth << "x" << blockHeight << ";bins " << numOfBins << ";edge " << static_cast<int>(edge);
+    return key.str();
+}
+
+std::map<std::string, std::string> Histogram::readTuningFile() {
+    // One entry per line, the key and the tuned values separated by a tab
+    std::map<std::string, std::string> entries;
+    std::ifstream file(tuningFile);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t separator = line.find('\t');
+        if (separator != std::string::npos) {
+            entries[line.substr(0, separator)] = line.substr(separator + 1);
+        }
+    }
+    return entries;
+}
+
+void Histogram::writeTuningFile(const std::map<std::string, std::string> &entries) {
+    // Written to a temporary file and renamed, so processes starting at the same time never read a partial file
+    std::error_code error;
+    std::filesystem::path path(tuningFile);
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), error);
+    }
+    std::string temporaryPath = tuningFile + "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporaryPath);
+        for (const auto &entry : entries) {
+            file << entry.first << "\t" << entry.second << "\n";
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        if (showErrors) {
+            std::cout << "Tuning File ERROR: could not write " << tuningFile << std::endl;
+        }
+    }
 }
 
-void Histogram::createOutputVectors() {
-    // Initialize Output Vectors
-    yAverage = std::vector<float>(yNumOfBlocks);
-    uAverage = std::vector<float>(uNumOfBlocks);
-    vAverage = std::vector<float>(vNumOfBlocks);
-    yVariance = std::vector<float>(yNumOfBlocks);
-    uVariance = std::vector<float>(uNumOfBlocks);
-    vVariance = std::vector<float>(vNumOfBlocks);
-    yAverageBins = std::vector<int>(numOfBins);
-    uAverageBins = std::vector<int>(numOfBins);
-    vAverageBins = std::vector<int>(numOfBins);
-    yVarianceBins = std::vector<varhist>(numOfBins);
-    uVarianceBins = std::vector<varhist>(numOfBins);
-    vVarianceBins = std::vector<varhist>(numOfBins);
+void Histogram::createOutputVectors(Result &result, int numOfFrames) {
+    // Sized in place, so a result reused for every frame is only allocated when the configuration changes, the histograms are cleared to be accumulated
+    result.yAverage.resize(yNumOfBlocks * numOfFrames);
+    result.uAverage.resize(uNumOfBlocks * numOfFrames);
+    result.vAverage.resize(vNumOfBlocks * numOfFrames);
+    result.yVariance.resize(yNumOfBlocks * numOfFrames);
+    result.uVariance.resize(uNumOfBlocks * numOfFrames);
+    result.vVariance.resize(vNumOfBlocks * numOfFrames);
+    result.yAverageBins.assign(numOfBins * numOfFrames, 0);
+    result.uAverageBins.assign(numOfBins * numOfFrames, 0);
+    result.vAverageBins.assign(numOfBins * numOfFrames, 0);
+    result.yVarianceBins.assign(numOfBins * numOfFrames, 0);
+    result.uVarianceBins.assign(numOfBins * numOfFrames, 0);
+    result.vVarianceBins.assign(numOfBins * numOfFrames, 0);
 }
 
-void Histogram::createInputBuffers() {
+void Histogram::createInputBuffers(BufferSet &set) {
+    if (&set == &buffers) {
+        unmapInputBuffer();
+    }
+
     // Initialize Input Buffers
-    imageBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, imageSize * sizeof(int), NULL, &clError);
+    set.imageBufferSize = imageSize * sampleSize * set.numOfFrames;
+    set.imageBuffer = cl::Buffer(context, memoryFlags(CL_MEM_READ_ONLY), set.imageBufferSize, NULL, &clError);
     if (showErrors && clError < 0) {
         std::cout << "Create imageBuffer ERROR: " << clError << std::endl;
     }
-    numOfBinsBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, 1 * sizeof(int), NULL, &clError);
+    set.numOfBinsBuffer = cl::Buffer(context, memoryFlags(CL_MEM_READ_ONLY), 1 * sizeof(int), NULL, &clError);
     if (showErrors && clError < 0) {
         std::cout << "Create numOfBinsBuffer ERROR: " << clError << std::endl;
     }
-    formatBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, 1 * sizeof(int), NULL, &clError);
+    set.formatBuffer = cl::Buffer(context, memoryFlags(CL_MEM_READ_ONLY), FormatFieldCount * sizeof(int), NULL, &clError);
     if (showErrors && clError < 0) {
         std::cout << "Create formatBuffer ERROR: " << clError << std::endl;
     }
-}
+    set.formatDescriptor.clear();
+}
+
+void Histogram::writeInputBuffers(std::vector<int> imageVector) {
+    if (input != Input::Int) {
+        if (showErrors) {
+            std::cout << "Write imageBuffer ERROR: input type is not Int" << std::endl;
+        }
+        return;
+    }
+
+    // The vector is a copy that does not outlive the call, so the backends that read the frame from the memory of the caller keep their own copy
+    if (hybridBackend || adaptiveBackend) {
+        const uint8_t *data = reinterpret_cast<const uint8_t *>(imageVector.data());
+        hostImage.assign(data, data + imageVector.size() * sizeof(int));
+        writeInputBuffers((const void *)hostImage.data());
+        return;
+    }
+    writeInputBuffers(imageVector.data());
+}
+
+void Histogram::writeInputBuffers(const std::vector<uint8_t> &imageVector) {
+    if (input != Input::Native || bitDepth() != 8) {
+        if (showErrors) {
+            std::cout << "Write imageBuffer ERROR: input type is not Native 8 bit" << std::endl;
+        }
+        return;
+    }
+    writeInputBuffers(imageVector.data());
+}
+
+void Histogram::writeInputBuffers(const std::vector<uint16_t> &imageVector) {
+    if (input != Input::Native || bitDepth() == 8) {
+        if (showErrors) {
+            std::cout << "Write imageBuffer ERROR: input type is not Native high bit depth" << std::endl;
+        }
+        return;
+    }
+    writeInputBuffers(imageVector.data());
+}
+
+void Histogram::writeInputBuffers(const void *ptr) {
+    writeInputBuffers(tightPlanes(ptr));
+}
+
+void Histogram::writeInputBuffers(const std::vector<Plane> &planes) {
+    if (cpuBackend) {
+        writeHostImage(planes);
+        return;
+    }
+
+    // The hybrid and adaptive backends read the frame from the memory of the caller when it is calculated, so it is copied only by the side it is sent to
+    if (hybridBackend || adaptiveBackend) {
+        setHostPlanes(validPlanes(planes) ? planes : std::vector<Plane>());
+        return;
+    }
+    unmapInputBuffer();
+    writeInputBuffers(buffers, planes, numOfBlocksY);
+}
+
+void *Histogram::mapInputBuffer() {
+    if (!environmentSetUp) {
+        std::cout << "Environment not set up" << std::endl;
+        return NULL;
+    }
+
+    // The backends that calculate on the host keep the frame in host memory
+    if (cpuBackend || hybridBackend || adaptiveBackend) {
+        hostImage.resize((size_t)imageSize * sampleSize);
+        setHostPlanes(tightPlanes(hostImage.data()));
+        return hostImage.data();
+    }
+    unmapInputBuffer();
+    writeTightFormat(buffers);
+
+    mappedImage = buffers.queue.enqueueMapBuffer(buffers.imageBuffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, (size_t)imageSize * sampleSize, NULL, NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Map imageBuffer ERROR: " << clError << std::endl;
+    }
+    return mappedImage;
+}
+
+void Histogram::unmapInputBuffer() {
+    if (mappedImage == NULL) {
+        return;
+    }
+    clError = buffers.queue.enqueueUnmapMemObject(buffers.imageBuffer, mappedImage, NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Unmap imageBuffer ERROR: " << clError << std::endl;
+    }
+    mappedImage = NULL;
+}
+
+std::vector<Histogram::Plane> Histogram::tightPlanes(const void *ptr) {
+    // Tightly packed planes stored back to back
+    std::vector<Plane> planes;
+    const char *data = (const char *)ptr;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        int pitch = planeWidth(plane) * sampleSize;
+        planes.push_back({data, pitch});
+        data += (size_t)pitch * planeHeight(plane);
+    }
+    return planes;
+}
+
+bool Histogram::validPlanes(const std::vector<Plane> &planes) {
+    if ((int)planes.size() != numOfPlanes()) {
+        if (showErrors) {
+            std::cout << "Write imageBuffer ERROR: expected " << numOfPlanes() << " planes" << std::endl;
+        }
+        return false;
+    }
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        if (planes[plane].pitch % sampleSize != 0 || planes[plane].pitch / (int)sampleSize < planeWidth(plane)) {
+            if (showErrors) {
+                std::cout << "Write imageBuffer ERROR: invalid pitch for plane " << plane << std::endl;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<int> Histogram::planeGeometry() {
+    std::vector<int> geometry = {(int)sampleSize};
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        geometry.push_back(planeWidth(plane));
+        geometry.push_back(planeHeight(plane));
+    }
+    return geometry;
+}
+
+void Histogram::setHostPlanes(const std::vector<Plane> &planes) {
+    hostPlanes = planes;
+    hostGeometry = planeGeometry();
+}
+
+bool Histogram::validFrame() {
+    // The backends on the host calculate the planes written, the device calculates its image buffer, which is created again for another format or image size
+    bool written = (cpuBackend || hybridBackend || adaptiveBackend) ? !hostPlanes.empty() : !buffers.formatDescriptor.empty();
+    if (!written) {
+        if (showErrors) {
+            std::cout << "Calculate ERROR: no frame written for the format and image size" << std::endl;
+        }
+        return false;
+    }
+    return true;
+}
+
+void Histogram::writeInputBuffers(BufferSet &set, const std::vector<Plane> &planes, int blockRows) {
+    if (!validPlanes(planes)) {
+        return;
+    }
+
+    // Keep the pitch of each plane in the image buffer, so they are copied as they are
+    std::vector<int> planeOffsets;
+    std::vector<int> rowStrides;
+    size_t bufferSize = 0;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        planeOffsets.push_back(bufferSize / sampleSize);
+        rowStrides.push_back(planes[plane].pitch / sampleSize);
+        bufferSize += (size_t)planes[plane].pitch * planeHeight(plane);
+    }
+    calculateFormatDescriptor(planeOffsets, rowStrides);
+
+    // Grow the image buffer if the padded planes do not fit
+    if (bufferSize > set.imageBufferSize) {
+        set.imageBufferSize = bufferSize;
+        set.imageBuffer = cl::Buffer(context, memoryFlags(CL_MEM_READ_ONLY), set.imageBufferSize, NULL, &clError);
+        if (showErrors && clError < 0) {
+            std::cout << "Create imageBuffer ERROR: " << clError << std::endl;
+        }
+    }
+
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        // The padding after the last row is not read, nor the rows below the block rows calculated on the device
+        int rows = planeRows(plane, blockRows);
+        if (rows == 0) {
+            continue;
+        }
+        size_t planeSize = (size_t)planes[plane].pitch * (rows - 1) + planeWidth(plane) * sampleSize;
+        writeBuffer(set.queue, set.imageBuffer, planeOffsets[plane] * sampleSize, planeSize, planes[plane].data, "imageBuffer");
+    }
+    writeBuffer(set.queue, set.numOfBinsBuffer, 0, 1 * sizeof(int), &numOfBins, "numOfBinsBuffer");
+    writeBuffer(set.queue, set.formatBuffer, 0, FormatFieldCount * sizeof(int), &formatDescriptor[0], "formatBuffer");
+    set.formatDescriptor = formatDescriptor;
+}
+
+int Histogram::planeRows(int plane, int blockRows) {
+    int lumaRows = std::min(imgHeight, blockRows * blockHeight);
+    if (plane == 0) {
+        return lumaRows;
+    }
+    return std::min(chromaHeight(), (lumaRows + chromaSubsamplingY() - 1) / chromaSubsamplingY());
+}
+
+void Histogram::writeBatchBuffers(BufferSet &set, const void *ptr) {
+    // All the frames are uploaded with a single write, the frame stride of the descriptor skips to the next frame
+    writeBuffer(set.queue, set.imageBuffer, 0, (size_t)imageSize * sampleSize * set.numOfFrames, ptr, "imageBuffer");
+    writeTightFormat(set);
+}
+
+void Histogram::writeTightFormat(BufferSet &set) {
+    std::vector<int> planeOffsets;
+    std::vector<int> rowStrides;
+    int offset = 0;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        planeOffsets.push_back(offset);
+        rowStrides.push_back(planeWidth(plane));
+        offset += planeWidth(plane) * planeHeight(plane);
+    }
+    calculateFormatDescriptor(planeOffsets, rowStrides);
+    writeBuffer(set.queue, set.numOfBinsBuffer, 0, 1 * sizeof(int), &numOfBins, "numOfBinsBuffer");
+    writeBuffer(set.queue, set.formatBuffer, 0, FormatFieldCount * sizeof(int), &formatDescriptor[0], "formatBuffer");
+    set.formatDescriptor = formatDescriptor;
+}
+
+void Histogram::writeBuffer(cl::CommandQueue &queue, cl::Buffer &buffer, size_t offset, size_t size, const void *ptr, std::string name) {
+    clError = queue.enqueueWriteBuffer(buffer, CL_TRUE, offset, size, ptr, NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Write " << name << " ERROR: " << clError << std::endl;
+    }
+}
+
+cl_mem_flags Histogram::memoryFlags(cl_mem_flags flags) {
+    // Let the driver allocate host accessible memory, so the device reads a mapped frame where it was written
+    if (zeroCopy) {
+        return flags | CL_MEM_ALLOC_HOST_PTR;
+    }
+    return flags;
+}
+
+void Histogram::createTotalBuffer() {
+    totalBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, 6 * numOfBins * sizeof(cl_ulong), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create totalBuffer ERROR: " << clError << std::endl;
+    }
+}
+
+void Histogram::createOutputBuffers(BufferSet &set) {
+    unmapOutputBuffer(set);
+
+    // Sub-buffers must start at the base address alignment of the device, given in bits
+    size_t alignment = defaultDevice.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8;
+    if (alignment == 0) {
+        alignment = 128;
+    }
+    size_t offset = 0;
+    auto place = [&offset, alignment](size_t size) {
+        size_t origin = offset;
+        offset += (size + alignment - 1) / alignment * alignment;
+        return origin;
+    };
+
+    // The histograms come first, so they are read back without the details when those are not requested
+    size_t averageHistSize = numOfBins * sizeof(int) * set.numOfFrames;
+    size_t varianceHistSize = numOfBins * sizeof(varhist) * set.numOfFrames;
+    OutputLayout &layout = set.layout;
+    size_t varianceFixedSize = numOfBins * sizeof(cl_ulong) * set.numOfFrames;
+    layout.yAverageHist = place(averageHistSize);
+    layout.yVarianceHist = place(varianceHistSize);
+    layout.yVarianceFixed = place(varianceFixedSize);
+    layout.uAverageHist = place(averageHistSize);
+    layout.uVarianceHist = place(varianceHistSize);
+    layout.uVarianceFixed = place(varianceFixedSize);
+    layout.vAverageHist = place(averageHistSize);
+    layout.vVarianceHist = place(varianceHistSize);
+    layout.vVarianceFixed = place(varianceFixedSize);
+    layout.yAverage = place(yNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.yVariance = place(yNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.uAverage = place(uNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.uVariance = place(uNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.vAverage = place(vNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.vVariance = place(vNumOfBlocks * sizeof(float) * set.numOfFrames);
+    layout.size = offset;
+    layout.numOfBins = numOfBins;
+    layout.numOfBlocks = yNumOfBlocks;
+
+    set.outputBuffer = cl::Buffer(context, memoryFlags(CL_MEM_READ_WRITE), layout.size, NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create outputBuffer ERROR: " << clError << std::endl;
+    }
+
+    set.yAverageHistBuffer = createOutputRegion(set, layout.yAverageHist, averageHistSize, "yAverageHistBuffer");
+    set.uAverageHistBuffer = createOutputRegion(set, layout.uAverageHist, averageHistSize, "uAverageHistBuffer");
+    set.vAverageHistBuffer = createOutputRegion(set, layout.vAverageHist, averageHistSize, "vAverageHistBuffer");
+    set.yVarianceHistBuffer = createOutputRegion(set, layout.yVarianceHist, varianceHistSize, "yVarianceHistBuffer");
+    set.uVarianceHistBuffer = createOutputRegion(set, layout.uVarianceHist, varianceHistSize, "uVarianceHistBuffer");
+    set.vVarianceHistBuffer = createOutputRegion(set, layout.vVarianceHist, varianceHistSize, "vVarianceHistBuffer");
+    set.yAverageBuffer = createOutputRegion(set, layout.yAverage, yNumOfBlocks * sizeof(float) * set.numOfFrames, "yAverageBuffer");
+    set.yVarianceBuffer = createOutputRegion(set, layout.yVariance, yNumOfBlocks * sizeof(float) * set.numOfFrames, "yVarianceBuffer");
+    set.uAverageBuffer = createOutputRegion(set, layout.uAverage, uNumOfBlocks * sizeof(float) * set.numOfFrames, "uAverageBuffer");
+    set.uVarianceBuffer = createOutputRegion(set, layout.uVariance, uNumOfBlocks * sizeof(float) * set.numOfFrames, "uVarianceBuffer");
+    set.vAverageBuffer = createOutputRegion(set, layout.vAverage, vNumOfBlocks * sizeof(float) * set.numOfFrames, "vAverageBuffer");
+    set.vVarianceBuffer = createOutputRegion(set, layout.vVariance, vNumOfBlocks * sizeof(float) * set.numOfFrames, "vVarianceBuffer");
+
+    set.yVarianceFixedBuffer = createOutputRegion(set, layout.yVarianceFixed, varianceFixedSize, "yVarianceFixedBuffer");
+    set.uVarianceFixedBuffer = createOutputRegion(set, layout.uVarianceFixed, varianceFixedSize, "uVarianceFixedBuffer");
+    set.vVarianceFixedBuffer = createOutputRegion(set, layout.vVarianceFixed, varianceFixedSize, "vVarianceFixedBuffer");
+
+    // The scratch buffers of the two stage reduction are created again for the new output buffers
+    set.numOfGroups = 0;
+
+    // Initialize Hist Buffer
+    resetHistBuffers(set);
+}
+
+cl::Buffer Histogram::createOutputRegion(BufferSet &set, size_t origin, size_t size, std::string name) {
+    cl_buffer_region region = {origin, size};
+    cl::Buffer buffer = set.outputBuffer.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create " << name << " ERROR: " << clError << std::endl;
+    }
+    return buffer;
+}
+
+void Histogram::resetHistBuffers(BufferSet &set) {
+    // The outputs of the previous frame are no longer read once the next one is calculated
+    unmapOutputBuffer(set);
+
+    // The float variance histograms are written by the conversion, only the fixed point ones are accumulated
+    int zero = 0;
+    for (cl::Buffer *buffer : {&set.yAverageHistBuffer, &set.uAverageHistBuffer, &set.vAverageHistBuffer}) {
+        clError = set.queue.enqueueFillBuffer(*buffer, zero, 0, numOfBins * sizeof(int) * set.numOfFrames, NULL, NULL);
+        if (showErrors && clError < 0) {
+            std::cout << "Reset HistBuffer ERROR: " << clError << std::endl;
+        }
+    }
+    cl_ulong fixedZero = 0;
+    for (cl::Buffer *buffer : {&set.yVarianceFixedBuffer, &set.uVarianceFixedBuffer, &set.vVarianceFixedBuffer}) {
+        clError = set.queue.enqueueFillBuffer(*buffer, fixedZero, 0, numOfBins * sizeof(cl_ulong) * set.numOfFrames, NULL, NULL);
+        if (showErrors && clError < 0) {
+            std::cout << "Reset HistBuffer ERROR: " << clError << std::endl;
+        }
+    }
+}
+
+void Histogram::calculateSizes() {
+    // The layout of the output buffer changes, so the outputs read back before are no longer viewed in it
+    fusedOutput = NULL;
+    ySize = imgWidth * imgHeight;
+    uSize = chromaWidth() * chromaHeight();
+    vSize = chromaWidth() * chromaHeight();
+
+    // Packed formats pad odd widths to a whole macropixel
+    imageSize = 0;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        imageSize += planeWidth(plane) * planeHeight(plane);
+    }
+
+    // Samples are stored in 16 bit words for high bit depth formats
+    if (input == Input::Int) {
+        sampleSize = sizeof(int);
+    }
+    else if (bitDepth() > 8) {
+        sampleSize = sizeof(uint16_t);
+    }
+    else {
+        sampleSize = sizeof(uint8_t);
+    }
+
+    // The frame written for the backends on the host no longer matches the planes of another format or image size
+    if (hostGeometry != planeGeometry()) {
+        hostPlanes.clear();
+    }
+
+    // Sum of squares of high bit depth blocks, and of 8 bit blocks of more than 33025 pixels, does not fit in 32 bits
+    accumulatorSize = (bitDepth() > 8 || wideAccumulators()) ? sizeof(cl_ulong) : sizeof(int);
+
+    // Every block covers the same area of each channel
+    numOfBlocksX = numOfBlocks(imgWidth, blockWidth);
+    numOfBlocksY = numOfBlocks(imgHeight, blockHeight);
+
+    yBlockWidth = blockWidth;
+    yBlockHeight = blockHeight;
+    yBlockSize = yBlockWidth * yBlockHeight;
+    yNumOfBlocks = numOfBlocksX * numOfBlocksY;
+
+    uBlockWidth = blockWidth/chromaSubsamplingX();
+    uBlockHeight = blockHeight/chromaSubsamplingY();
+    uBlockSize = uBlockWidth * uBlockHeight;
+    uNumOfBlocks = numOfBlocksX * numOfBlocksY;
+
+    vBlockWidth = blockWidth/chromaSubsamplingX();
+    vBlockHeight = blockHeight/chromaSubsamplingY();
+    vBlockSize = vBlockWidth * vBlockHeight;
+    vNumOfBlocks = numOfBlocksX * numOfBlocksY;
+
+    // The work group size is chosen for the device, independently of the block size (a power of two for the reduction)
+    localSize = 1;
+    while (localSize * 2 <= std::min(workGroupSize > 0 ? workGroupSize : 256, maxWorkGroupSize)) {
+        localSize *= 2;
+    }
+
+    // Every block is calculated by a segment of work items, each one summing about pixelsPerItem samples of the block
+    itemsPerBlock = 1;
+    while (itemsPerBlock < localSize && itemsPerBlock * pixelsPerItem < yBlockSize) {
+        itemsPerBlock *= 2;
+    }
+
+    // Every work group calculates a run of consecutive blocks of a row, rounded to the blocks calculated at the same time
+    int blocksPerPass = localSize / itemsPerBlock;
+    groupBlocks = ((std::max(blocksPerGroup, blocksPerPass) + blocksPerPass - 1) / blocksPerPass) * blocksPerPass;
+    int numOfGroupsX = (numOfBlocksX + groupBlocks - 1) / groupBlocks;
+    globalRange = cl::NDRange(numOfGroupsX * localSize, numOfBlocksY);
+    localRange = cl::NDRange(localSize, 1);
+}
+
+void Histogram::calculateBlockFields(std::vector<int> &descriptor) {
+    descriptor[EdgePolicy] = static_cast<int>(edge);
+
+    // Frames of a batch are tightly packed and stored back to back
+    descriptor[FrameStride] = imageSize;
+
+    descriptor[NumOfBlocksX] = numOfBlocksX;
+    descriptor[NumOfBlocksY] = numOfBlocksY;
+
+    descriptor[BlockWidth] = blockWidth;
+    descriptor[BlockHeight] = blockHeight;
+    descriptor[BlocksPerGroup] = groupBlocks;
+    descriptor[ItemsPerBlock] = itemsPerBlock;
+}
+
+void Histogram::updateFormatDescriptor(BufferSet &set) {
+    // The planes of the image uploaded stay the same, only the blocks calculated from them change
+    if (set.formatDescriptor.empty()) {
+        return;
+    }
+    std::vector<int> descriptor = set.formatDescriptor;
+    calculateBlockFields(descriptor);
+    if (descriptor != set.formatDescriptor) {
+        set.formatDescriptor = descriptor;
+        writeBuffer(set.queue, set.formatBuffer, 0, FormatFieldCount * sizeof(int), &set.formatDescriptor[0], "formatBuffer");
+    }
+}
+
+void Histogram::calculateFormatDescriptor(const std::vector<int> &planeOffsets, const std::vector<int> &rowStrides) {
+    formatDescriptor = std::vector<int>(FormatFieldCount);
+    formatDescriptor[ChromaSubsamplingX] = chromaSubsamplingX();
+    formatDescriptor[ChromaSubsamplingY] = chromaSubsamplingY();
+    calculateBlockFields(formatDescriptor);
+
+    // Luma plane first, followed by the chroma planes
+    formatDescriptor[YOffset] = planeOffsets[0];
+    formatDescriptor[YPixelStride] = lumaPixelStride();
+    formatDescriptor[UPixelStride] = formatDescriptor[VPixelStride] = chromaPixelStride();
+    formatDescriptor[YRowStride] = rowStrides[0];
+    formatDescriptor[YWidth] = imgWidth;
+    formatDescriptor[YHeight] = imgHeight;
+    formatDescriptor[UWidth] = formatDescriptor[VWidth] = chromaWidth();
+    formatDescriptor[UHeight] = formatDescriptor[VHeight] = chromaHeight();
+
+    switch (format) {
+        case Format::NV12:
+        case Format::P010:
+        case Format::P012:
+        case Format::P016:
+            // Semi-planar, interleaved UV plane
+            formatDescriptor[UOffset] = planeOffsets[1];
+            formatDescriptor[VOffset] = planeOffsets[1] + 1;
+            formatDescriptor[URowStride] = formatDescriptor[VRowStride] = rowStrides[1];
+            break;
+        case Format::NV21:
+            // Semi-planar, interleaved VU plane
+            formatDescriptor[VOffset] = planeOffsets[1];
+            formatDescriptor[UOffset] = planeOffsets[1] + 1;
+            formatDescriptor[URowStride] = formatDescriptor[VRowStride] = rowStrides[1];
+            break;
+        case Format::YV12:
+            // Planar, V plane before U plane
+            formatDescriptor[VOffset] = planeOffsets[1];
+            formatDescriptor[UOffset] = planeOffsets[2];
+            formatDescriptor[VRowStride] = rowStrides[1];
+            formatDescriptor[URowStride] = rowStrides[2];
+            break;
+        case Format::YUYV:
+        case Format::UYVY:
+            // Packed, a single plane of Y0 U Y1 V (or U Y0 V Y1) macropixels
+            formatDescriptor[YOffset] = planeOffsets[0] + ((format == Format::YUYV) ? 0 : 1);
+            formatDescriptor[UOffset] = planeOffsets[0] + ((format == Format::YUYV) ? 1 : 0);
+            formatDescriptor[VOffset] = formatDescriptor[UOffset] + 2;
+            formatDescriptor[URowStride] = formatDescriptor[VRowStride] = rowStrides[0];
+            break;
+        default:
+            // Planar, U plane before V plane
+            formatDescriptor[UOffset] = planeOffsets[1];
+            formatDescriptor[VOffset] = planeOffsets[2];
+            formatDescriptor[URowStride] = rowStrides[1];
+            formatDescriptor[VRowStride] = rowStrides[2];
+            break;
+    }
+}
+
+int Histogram::numOfPlanes() {
+    switch (format) {
+        case Format::YUYV:
+        case Format::UYVY:
+            return 1;
+        case Format::NV12:
+        case Format::NV21:
+        case Format::P010:
+        case Format::P012:
+        case Format::P016:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+int Histogram::planeWidth(int plane) {
+    if (plane == 0) {
+        // Packed formats store a luma and a chroma sample per pixel, in whole macropixels
+        return (numOfPlanes() == 1) ? 4 * chromaWidth() : imgWidth;
+    }
+    // Semi-planar formats interleave both chroma channels
+    return (numOfPlanes() == 2) ? 2 * chromaWidth() : chromaWidth();
+}
+
+int Histogram::planeHeight(int plane) {
+    if (plane == 0) {
+        return imgHeight;
+    }
+    return chromaHeight();
+}
+
+int Histogram::chromaWidth() {
+    return (imgWidth + chromaSubsamplingX() - 1) / chromaSubsamplingX();
+}
+
+int Histogram::chromaHeight() {
+    return (imgHeight + chromaSubsamplingY() - 1) / chromaSubsamplingY();
+}
+
+void Histogram::calculateHistograms() {
+    if (!environmentSetUp) {
+        std::cout << "Environment not set up" << std::endl;
+        return;
+    }
+    calculateHistograms(Detail::Exclude);
+}
+
+void Histogram::calculateHistograms(Detail detail) {
+    if (!environmentSetUp) {
+        std::cout << "Environment not set up" << std::endl;
+        return;
+    }
+    // Frames read back from the device switch the outputs to the host memory they are read to again
+    fusedOutput = NULL;
+    calculateHistograms(detail, output);
+}
+
+void Histogram::calculateHistograms(Detail detail, Result &result) {
+    if (!environmentSetUp) {
+        std::cout << "Environment not set up" << std::endl;
+        return;
+    }
+    unmapInputBuffer();
+    if (!validFrame()) {
+        return;
+    }
+    if (cpuBackend) {
+        bool stream = accumulation == Accumulation::Stream;
+        calculateFrameCPU(hostPlanes, detail, result, stream ? &hostTotals : NULL);
+        accumulatedFrames += stream ? 1 : 0;
+        elapsedTime = result.elapsedTime;
+        lastBackend = Backend::CPU;
+        return;
+    }
+    if (!kernelsLoaded) {
+        loadKernels();
+    }
+
+    // The totals are kept on the device, so the frames accumulated are calculated there whatever the backend
+    if (accumulation == Accumulation::Stream) {
+        if (hybridBackend || adaptiveBackend) {
+            writeInputBuffers(buffers, hostPlanes, numOfBlocksY);
+        }
+        calculateFrameDevice(detail, result);
+        lastBackend = Backend::OpenCL;
+        return;
+    }
+    if (hybridBackend) {
+        calculateFrameHybrid(detail, result);
+        lastBackend = Backend::Hybrid;
+        return;
+    }
+    if (adaptiveBackend) {
+        calculateFrameAdaptive(detail, result);
+        return;
+    }
+    calculateFrameDevice(detail, result);
+    lastBackend = Backend::OpenCL;
+}
+
+void Histogram::calculateFrameDevice(Detail detail, Result &result) {
+    // Reset Timers
+    elapsedTime = 0;
+
+    // The histograms of the previous frame are cleared in the same batch of commands as the kernel
+    resetHistBuffers(buffers);
+    cl::Event event;
+    cl::Kernel kernel = setKernelArgs(buffers, detail);
+    clError = buffers.queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange, NULL, &event);
+    if (showErrors && clError < 0) {
+        std::cout << "Execution ERROR: " << clError << std::endl;
+    }
+
+    finishHistograms(buffers, numOfBlocksY);
+
+    // Frames accumulated on the device are not waited for nor read back
+    if (accumulation == Accumulation::Stream) {
+        accumulateHistograms(buffers);
+        accumulatedFrames++;
+        buffers.queue.flush();
+        return;
+    }
+
+    // The read back is enqueued behind the kernels, so the frame is waited for only once, the result is sized by it
+    readOutputBuffers(buffers, detail, result);
+    elapsedTime = (1e-6) * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+    result.elapsedTime = elapsedTime;
+}
+
+cl::Kernel Histogram::setKernelArgs(BufferSet &set, Detail detail) {
+    cl::Kernel kernel;
+
+    // The blocks may have been configured again since the image was uploaded
+    updateFormatDescriptor(set);
+
+    // The two stage reduction writes the histograms of every work group to the scratch buffers
+    bool twoStage = reduction == Reduction::TwoStage;
+    if (twoStage) {
+        createPartialBuffers(set);
+    }
+    cl::Buffer &yAverageBins = twoStage ? set.yPartialAverageBuffer : set.yAverageHistBuffer;
+    cl::Buffer &uAverageBins = twoStage ? set.uPartialAverageBuffer : set.uAverageHistBuffer;
+    cl::Buffer &vAverageBins = twoStage ? set.vPartialAverageBuffer : set.vAverageHistBuffer;
+    cl::Buffer &yVarianceBins = twoStage ? set.yPartialVarianceBuffer : set.yVarianceFixedBuffer;
+    cl::Buffer &uVarianceBins = twoStage ? set.uPartialVarianceBuffer : set.uVarianceFixedBuffer;
+    cl::Buffer &vVarianceBins = twoStage ? set.vPartialVarianceBuffer : set.vVarianceFixedBuffer;
+
+    // Set Kernel Args
+    if (color == Color::Chromatic) {
+        if (detail == Detail::Exclude) {
+            kernel = histogramsKernel;
+            kernel.setArg(0, set.imageBuffer);
+            kernel.setArg(1, set.numOfBinsBuffer);
+            kernel.setArg(2, set.formatBuffer);
+            kernel.setArg(3, yAverageBins);
+            kernel.setArg(4, yVarianceBins);
+            kernel.setArg(5, uAverageBins);
+            kernel.setArg(6, uVarianceBins);
+            kernel.setArg(7, vAverageBins);
+            kernel.setArg(8, vVarianceBins);
+            kernel.setArg(9, localSize * accumulatorSize, NULL);
+            kernel.setArg(10, localSize * accumulatorSize, NULL);
+            kernel.setArg(11, localSize * accumulatorSize, NULL);
+            kernel.setArg(12, localSize * accumulatorSize, NULL);
+            kernel.setArg(13, localSize * accumulatorSize, NULL);
+            kernel.setArg(14, localSize * accumulatorSize, NULL);
+            kernel.setArg(15, numOfBins * sizeof(int), NULL);
+            kernel.setArg(16, numOfBins * sizeof(cl_ulong), NULL);
+            kernel.setArg(17, numOfBins * sizeof(int), NULL);
+            kernel.setArg(18, numOfBins * sizeof(cl_ulong), NULL);
+            kernel.setArg(19, numOfBins * sizeof(int), NULL);
+            kernel.setArg(20, numOfBins * sizeof(cl_ulong), NULL);
+        }
+        else {
+            kernel = histogramsDetailKernel;
+            kernel.setArg(0, set.imageBuffer);
+            kernel.setArg(1, set.numOfBinsBuffer);
+            kernel.setArg(2, set.formatBuffer);
+            kernel.setArg(3, set.yAverageBuffer);
+            kernel.setArg(4, set.yVarianceBuffer);
+            kernel.setArg(5, yAverageBins);
+            kernel.setArg(6, yVarianceBins);
+            kernel.setArg(7, set.uAverageBuffer);
+            kernel.setArg(8, set.uVarianceBuffer);
+            kernel.setArg(9, uAverageBins);
+            kernel.setArg(10, uVarianceBins);
+            kernel.setArg(11, set.vAverageBuffer);
+            kernel.setArg(12, set.vVarianceBuffer);
+            kernel.setArg(13, vAverageBins);
+            kernel.setArg(14, vVarianceBins);
+            kernel.setArg(15, localSize * accumulatorSize, NULL);
+            kernel.setArg(16, localSize * accumulatorSize, NULL);
+            kernel.setArg(17, localSize * accumulatorSize, NULL);
+            kernel.setArg(18, localSize * accumulatorSize, NULL);
+            kernel.setArg(19, localSize * accumulatorSize, NULL);
+            kernel.setArg(20, localSize * accumulatorSize, NULL);
+            kernel.setArg(21, numOfBins * sizeof(int), NULL);
+            kernel.setArg(22, numOfBins * sizeof(cl_ulong), NULL);
+            kernel.setArg(23, numOfBins * sizeof(int), NULL);
+            kernel.setArg(24, numOfBins * sizeof(cl_ulong), NULL);
+            kernel.setArg(25, numOfBins * sizeof(int), NULL);
+            kernel.setArg(26, numOfBins * sizeof(cl_ulong), NULL);
+        }
+    }
+    else {
+        if (detail == Detail::Exclude) {
+            kernel = singleChannelKernel;
+            kernel.setArg(0, set.imageBuffer);
+            kernel.setArg(1, set.numOfBinsBuffer);
+            kernel.setArg(2, set.formatBuffer);
+            kernel.setArg(3, yAverageBins);
+            kernel.setArg(4, yVarianceBins);
+            kernel.setArg(5, localSize * accumulatorSize, NULL);
+            kernel.setArg(6, localSize * accumulatorSize, NULL);
+            kernel.setArg(7, numOfBins * sizeof(int), NULL);
+            kernel.setArg(8, numOfBins * sizeof(cl_ulong), NULL);
+        }
+        else {
+            kernel = singleChannelDetailKernel;
+            kernel.setArg(0, set.imageBuffer);
+            kernel.setArg(1, set.numOfBinsBuffer);
+            kernel.setArg(2, set.formatBuffer);
+            kernel.setArg(3, set.yAverageBuffer);
+            kernel.setArg(4, set.yVarianceBuffer);
+            kernel.setArg(5, yAverageBins);
+            kernel.setArg(6, yVarianceBins);
+            kernel.setArg(7, localSize * accumulatorSize, NULL);
+            kernel.setArg(8, localSize * accumulatorSize, NULL);
+            kernel.setArg(9, numOfBins * sizeof(int), NULL);
+            kernel.setArg(10, numOfBins * sizeof(cl_ulong), NULL);
+        }
+    }
+    return kernel;
+}
+
+void Histogram::createPartialBuffers(BufferSet &set) {
+    int numOfGroups = (globalRange.get()[0] / localRange.get()[0]) * globalRange.get()[1];
+    if (set.numOfGroups == numOfGroups) {
+        return;
+    }
+    set.numOfGroups = numOfGroups;
+
+    // Every work group writes all the bins of its histograms, so the scratch buffers are never reset
+    size_t partialBins = (size_t)numOfGroups * numOfBins * set.numOfFrames;
+    set.yPartialAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(int), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create yPartialAverageBuffer ERROR: " << clError << std::endl;
+    }
+    set.uPartialAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(int), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create uPartialAverageBuffer ERROR: " << clError << std::endl;
+    }
+    set.vPartialAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(int), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create vPartialAverageBuffer ERROR: " << clError << std::endl;
+    }
+    set.yPartialVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(cl_ulong), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create yPartialVarianceBuffer ERROR: " << clError << std::endl;
+    }
+    set.uPartialVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(cl_ulong), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create uPartialVarianceBuffer ERROR: " << clError << std::endl;
+    }
+    set.vPartialVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, partialBins * sizeof(cl_ulong), NULL, &clError);
+    if (showErrors && clError < 0) {
+        std::cout << "Create vPartialVarianceBuffer ERROR: " << clError << std::endl;
+    }
+}
+
+void Histogram::finishHistograms(BufferSet &set, int blockRows) {
+    // One work item per bin of every frame and channel
+    cl::NDRange binRange(numOfBins * set.numOfFrames, color == Color::Chromatic ? 3 : 1);
+
+    if (reduction == Reduction::TwoStage) {
+        // Only the work groups of the launched block rows wrote their partial histograms
+        int numOfGroups = (globalRange.get()[0] / localRange.get()[0]) * blockRows;
+        reduceKernel.setArg(0, set.numOfBinsBuffer);
+        reduceKernel.setArg(1, numOfGroups);
+        reduceKernel.setArg(2, set.yPartialAverageBuffer);
+        reduceKernel.setArg(3, set.yPartialVarianceBuffer);
+        reduceKernel.setArg(4, set.uPartialAverageBuffer);
+        reduceKernel.setArg(5, set.uPartialVarianceBuffer);
+        reduceKernel.setArg(6, set.vPartialAverageBuffer);
+        reduceKernel.setArg(7, set.vPartialVarianceBuffer);
+        reduceKernel.setArg(8, set.yAverageHistBuffer);
+        reduceKernel.setArg(9, set.yVarianceHistBuffer);
+        reduceKernel.setArg(10, set.uAverageHistBuffer);
+        reduceKernel.setArg(11, set.uVarianceHistBuffer);
+        reduceKernel.setArg(12, set.vAverageHistBuffer);
+        reduceKernel.setArg(13, set.vVarianceHistBuffer);
+        reduceKernel.setArg(14, set.yVarianceFixedBuffer);
+        reduceKernel.setArg(15, set.uVarianceFixedBuffer);
+        reduceKernel.setArg(16, set.vVarianceFixedBuffer);
+
+        // A work group per bin and channel, as many work items as groups to add up to the largest power of two the kernel can be launched with
+        int reduceSize = 1;
+        while (reduceSize * 2 <= std::min(numOfGroups, reduceWorkGroupSize)) {
+            reduceSize *= 2;
+        }
+        reduceKernel.setArg(17, reduceSize * sizeof(int), NULL);
+        reduceKernel.setArg(18, reduceSize * sizeof(cl_ulong), NULL);
+        cl::NDRange reduceRange(binRange.get()[0] * reduceSize, binRange.get()[1]);
+        clError = set.queue.enqueueNDRangeKernel(reduceKernel, cl::NullRange, reduceRange, cl::NDRange(reduceSize, 1), NULL, NULL);
+        if (showErrors && clError < 0) {
+            std::cout << "Reduction ERROR: " << clError << std::endl;
+        }
+        return;
+    }
+
+    convertKernel.setArg(0, set.yVarianceFixedBuffer);
+    convertKernel.setArg(1, set.uVarianceFixedBuffer);
+    convertKernel.setArg(2, set.vVarianceFixedBuffer);
+    convertKernel.setArg(3, set.yVarianceHistBuffer);
+    convertKernel.setArg(4, set.uVarianceHistBuffer);
+    convertKernel.setArg(5, set.vVarianceHistBuffer);
+    clError = set.queue.enqueueNDRangeKernel(convertKernel, cl::NullRange, binRange, cl::NullRange, NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Conversion ERROR: " << clError << std::endl;
+    }
+}
+
+void Histogram::accumulateHistograms(BufferSet &set) {
+    accumulateKernel.setArg(0, set.numOfBinsBuffer);
+    accumulateKernel.setArg(1, set.yAverageHistBuffer);
+    accumulateKernel.setArg(2, set.yVarianceFixedBuffer);
+    accumulateKernel.setArg(3, set.uAverageHistBuffer);
+    accumulateKernel.setArg(4, set.uVarianceFixedBuffer);
+    accumulateKernel.setArg(5, set.vAverageHistBuffer);
+    accumulateKernel.setArg(6, set.vVarianceFixedBuffer);
+    accumulateKernel.setArg(7, totalBuffer);
+    cl::NDRange binRange(numOfBins, color == Color::Chromatic ? 3 : 1);
+    clError = set.queue.enqueueNDRangeKernel(accumulateKernel, cl::NullRange, binRange, cl::NullRange, NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Accumulation ERROR: " << clError << std::endl;
+    }
+}
+
+std::vector<cl_ulong> Histogram::readAccumulation(Channel channel, bool variance) {
+    int index = 2 * ((channel == Channel::U) ? 1 : ((channel == Channel::V) ? 2 : 0)) + (variance ? 1 : 0);
+    std::vector<cl_ulong> totals(numOfBins, 0);
+    if (!environmentSetUp) {
+        return totals;
+    }
+    if (cpuBackend) {
+        std::copy(hostTotals.begin() + index * numOfBins, hostTotals.begin() + (index + 1) * numOfBins, totals.begin());
+        return totals;
+    }
+
+    // The read waits for the frames accumulated before it
+    clError = buffers.queue.enqueueReadBuffer(totalBuffer, CL_TRUE, index * numOfBins * sizeof(cl_ulong), numOfBins * sizeof(cl_ulong), totals.data(), NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Reading totalBuffer ERROR: " << clError << std::endl;
+    }
+    return totals;
+}
+
+void Histogram::calculateFrameAdaptive(Detail detail, Result &result) {
+    DispatchCost &cost = dispatchCosts[dispatchKey(detail)];
+
+    // Measure both backends first, then use the faster one and measure the other one again every 32 frames
+    bool useDevice = true;
+    if (cost.deviceTime > 0 && cost.cpuTime == 0) {
+        useDevice = false;
+    }
+    else if (cost.deviceTime > 0) {
+        useDevice = (cost.deviceTime <= cost.cpuTime) != (cost.frames % 32 == 0);
+    }
+    cost.frames++;
+
+    // The time of the device includes the upload, the launches and the read back, as seen by the caller
+    auto start = std::chrono::steady_clock::now();
+    if (useDevice) {
+        writeInputBuffers(buffers, hostPlanes, numOfBlocksY);
+        calculateFrameDevice(detail, result);
+    }
+    else {
+        calculateFrameCPU(hostPlanes, detail, result, NULL);
+    }
+    double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double &estimate = useDevice ? cost.deviceTime : cost.cpuTime;
+    estimate = (estimate > 0) ? (estimate + time) / 2 : time;
+    lastBackend = useDevice ? Backend::OpenCL : Backend::CPU;
+    elapsedTime = time;
+    result.elapsedTime = time;
+}
+
+std::string Histogram::dispatchKey(Detail detail) {
+    // The build options hold the format and the block configuration, the image size and the detail change the cost too
+    return buildOptions() + " " + std::to_string(imgWidth) + "x" + std::to_string(imgHeight) + ((detail == Detail::Include) ? " detail" : "");
+}
+
+void Histogram::calculateFrameHybrid(Detail detail, Result &result) {
+    auto start = std::chrono::steady_clock::now();
+    createOutputVectors(result, 1);
+    elapsedTime = 0;
+    if (numOfBlocksY == 0) {
+        return;
+    }
+
+    // Split the block rows by the time per block row of each side, both keep a block row so they are still measured
+    int rows = numOfBlocksY / 2;
+    if (deviceRowTime > 0 && cpuRowTime > 0) {
+        rows = (int)std::lround(numOfBlocksY * cpuRowTime / (deviceRowTime + cpuRowTime));
+    }
+    deviceRows = (numOfBlocksY > 1) ? std::min(std::max(rows, 1), numOfBlocksY - 1) : numOfBlocksY;
+
+    // The device calculates the first block rows in the background, only the rows of the planes they cover are uploaded
+    writeInputBuffers(buffers, hostPlanes, deviceRows);
+    resetHistBuffers(buffers);
+    cl::Event event;
+    cl::Kernel kernel = setKernelArgs(buffers, detail);
+    clError = buffers.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalRange.get()[0], deviceRows), localRange, NULL, &event);
+    if (showErrors && clError < 0) {
+        std::cout << "Execution ERROR: " << clError << std::endl;
+    }
+    if (reduction == Reduction::TwoStage) {
+        finishHistograms(buffers, deviceRows);
+    }
+
+    // The outputs of the device are read back with a single transfer, behind the kernels and without waiting for them
+    cl::Event readEvent;
+    const char *deviceOutput = fetchOutputs(buffers, detail, NULL, &readEvent);
+    buffers.queue.flush();
+
+    // The CPU backend calculates the rest meanwhile
+    auto cpuStart = std::chrono::steady_clock::now();
+    std::vector<cl_ulong> fixedVarianceBins(3 * numOfBins);
+    calculateRowsCPU(hostPlanes, detail, result, deviceRows, numOfBlocksY, fixedVarianceBins);
+    double cpuTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+    if (deviceOutput == NULL) {
+        return;
+    }
+    readEvent.wait();
 
-void Histogram::writeInputBuffers(std::vector<int> imageVector) {
-    clError = commandQueue.enqueueWriteBuffer(imageBuffer, CL_TRUE, 0, imageSize * sizeof(int), &imageVector[0], NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write imageBuffer ERROR: " << clError << std::endl;
+    // Add the histograms of the device in fixed point, so the result does not depend on the split
+    int numOfChannels = (color == Color::Chromatic) ? 3 : 1;
+    const OutputLayout &layout = buffers.layout;
+    size_t averageHists[3] = {layout.yAverageHist, layout.uAverageHist, layout.vAverageHist};
+    size_t varianceFixed[3] = {layout.yVarianceFixed, layout.uVarianceFixed, layout.vVarianceFixed};
+    int *averageBins[3] = {result.yAverageBins.data(), result.uAverageBins.data(), result.vAverageBins.data()};
+    for (int channel = 0; channel < numOfChannels; channel++) {
+        const int *deviceAverageBins = reinterpret_cast<const int *>(deviceOutput + averageHists[channel]);
+        const cl_ulong *deviceVarianceBins = reinterpret_cast<const cl_ulong *>(deviceOutput + varianceFixed[channel]);
+        for (int bin = 0; bin < numOfBins; bin++) {
+            averageBins[channel][bin] += deviceAverageBins[bin];
+            fixedVarianceBins[channel * numOfBins + bin] += deviceVarianceBins[bin];
+        }
     }
-    clError = commandQueue.enqueueWriteBuffer(numOfBinsBuffer, CL_TRUE, 0, 1 * sizeof(int), &numOfBins, NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write numOfBinsBuffer ERROR: " << clError << std::endl;
+    convertVarianceBins(fixedVarianceBins, result);
+
+    // The details of the block rows of the device are at the start of the outputs
+    if (detail == Detail::Include) {
+        size_t deviceBlocks = (size_t)deviceRows * numOfBlocksX;
+        std::vector<float> *details[6] = {&result.yAverage, &result.yVariance, &result.uAverage, &result.uVariance, &result.vAverage, &result.vVariance};
+        size_t offsets[6] = {layout.yAverage, layout.yVariance, layout.uAverage, layout.uVariance, layout.vAverage, layout.vVariance};
+        for (int output = 0; output < 2 * numOfChannels; output++) {
+            const float *deviceDetails = reinterpret_cast<const float *>(deviceOutput + offsets[output]);
+            std::copy(deviceDetails, deviceDetails + deviceBlocks, details[output]->begin());
+        }
     }
-    clError = commandQueue.enqueueWriteBuffer(formatBuffer, CL_TRUE, 0, 1 * sizeof(int), &format, NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write formatBuffer ERROR: " << clError << std::endl;
+    unmapOutputBuffer(buffers);
+
+    // Time per block row of each side, from the submission of the kernel to its end on the device, smoothed over the frames
+    double deviceTime = (1e-6) * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>());
+    double deviceTimePerRow = deviceTime / deviceRows;
+    deviceRowTime = (deviceRowTime > 0) ? (deviceRowTime + deviceTimePerRow) / 2 : deviceTimePerRow;
+    if (numOfBlocksY > deviceRows) {
+        double cpuTimePerRow = cpuTime / (numOfBlocksY - deviceRows);
+        cpuRowTime = (cpuRowTime > 0) ? (cpuRowTime + cpuTimePerRow) / 2 : cpuTimePerRow;
     }
+
+    elapsedTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.elapsedTime = elapsedTime;
 }
 
-void Histogram::writeInputBuffers(const void *ptr) {
-    clError = commandQueue.enqueueWriteBuffer(imageBuffer, CL_TRUE, 0, imageSize * sizeof(int), ptr, NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write imageBuffer ERROR: " << clError << std::endl;
+void Histogram::readOutputBuffers(BufferSet &set, Detail detail, Result &result) {
+    bool environment = &result == &output && &set == &buffers;
+    char *ptr = NULL;
+    if (environment && outputMemory != NULL) {
+        if (outputMemorySize >= set.layout.size) {
+            ptr = (char *)outputMemory;
+        }
+        else if (showErrors) {
+            std::cout << "Output memory ERROR: " << set.layout.size << " bytes needed" << std::endl;
+        }
     }
-    clError = commandQueue.enqueueWriteBuffer(numOfBinsBuffer, CL_TRUE, 0, 1 * sizeof(int), &numOfBins, NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write numOfBinsBuffer ERROR: " << clError << std::endl;
+    const char *data = fetchOutputs(set, detail, ptr, NULL);
+    if (data == NULL) {
+        return;
     }
-    clError = commandQueue.enqueueWriteBuffer(formatBuffer, CL_TRUE, 0, 1 * sizeof(int), &format, NULL, NULL);            
-    if (showErrors && clError < 0) {
-        std::cout << "Write formatBuffer ERROR: " << clError << std::endl;
+
+    // The outputs of the environment stay mapped until the next frame of the buffer set
+    if (environment) {
+        fusedOutput = data;
+        return;
     }
+    unpackOutputs(set.layout, data, (color == Color::Chromatic) ? 3 : 1, detail, result, 0);
+    unmapOutputBuffer(set);
 }
 
-void Histogram::createOutputBuffers() {
-    yAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, yNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create yAverageBuffer ERROR: " << clError << std::endl;
-    }
-    uAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, uNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create uAverageBuffer ERROR: " << clError << std::endl;
+const char *Histogram::fetchOutputs(BufferSet &set, Detail detail, char *ptr, cl::Event *event) {
+    // Zero copy outputs are read where the device wrote them
+    cl::Event fetchEvent;
+    if (zeroCopy && ptr == NULL) {
+        unmapOutputBuffer(set);
+        set.mappedOutput = set.queue.enqueueMapBuffer(set.outputBuffer, CL_FALSE, CL_MAP_READ, 0, outputReadSize(set.layout, detail), NULL, &fetchEvent, &clError);
+        if (clError < 0) {
+            if (showErrors) {
+                std::cout << "Map outputBuffer ERROR: " << clError << std::endl;
+            }
+            set.mappedOutput = NULL;
+            return NULL;
+        }
+        ptr = (char *)set.mappedOutput;
     }
-    vAverageBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, vNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create vAverageBuffer ERROR: " << clError << std::endl;
+    else {
+        if (ptr == NULL) {
+            set.hostOutput.resize(set.layout.size);
+            ptr = set.hostOutput.data();
+        }
+        readOutputBuffers(set, detail, ptr, &fetchEvent);
+        if (clError < 0) {
+            return NULL;
+        }
     }
 
-    yVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, yNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create yAverageBuffer ERROR: " << clError << std::endl;
-    }
-    uVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, uNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create uVarianceBuffer ERROR: " << clError << std::endl;
+    // A single transfer, waited for once as the kernels before it in the queue are finished by then, unless the caller waits for it
+    if (event != NULL) {
+        *event = fetchEvent;
     }
-    vVarianceBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, vNumOfBlocks * sizeof(float), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create vVarianceBuffer ERROR: " << clError << std::endl;
+    else {
+        fetchEvent.wait();
     }
+    return ptr;
+}
 
-    yAverageHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(int), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create yAverageHistBuffer ERROR: " << clError << std::endl;
+void Histogram::unmapOutputBuffer(BufferSet &set) {
+    if (set.mappedOutput == NULL) {
+        return;
     }
-    uAverageHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(int), NULL, &clError);
+    clError = set.queue.enqueueUnmapMemObject(set.outputBuffer, set.mappedOutput, NULL, NULL);
     if (showErrors && clError < 0) {
-        std::cout << "Create uAverageHistBuffer ERROR: " << clError << std::endl;
+        std::cout << "Unmap outputBuffer ERROR: " << clError << std::endl;
     }
-    vAverageHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(int), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create vAverageHistBuffer ERROR: " << clError << std::endl;
+    if (fusedOutput == set.mappedOutput) {
+        fusedOutput = NULL;
     }
+    set.mappedOutput = NULL;
+}
 
-    yVarianceHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(varhist), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create yVarianceHistBuffer ERROR: " << clError << std::endl;
-    }
-    uVarianceHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(varhist), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create uVarianceHistBuffer ERROR: " << clError << std::endl;
+void Histogram::unpackOutputs(const OutputLayout &layout, const char *data, int numOfChannels, Detail detail, Result &result, int frame) {
+    int bins = layout.numOfBins;
+    int blocks = layout.numOfBlocks;
+    frameCopy(data, layout.yAverageHist, frame, bins, result.yAverageBins);
+    frameCopy(data, layout.yVarianceHist, frame, bins, result.yVarianceBins);
+    if (numOfChannels == 3) {
+        frameCopy(data, layout.uAverageHist, frame, bins, result.uAverageBins);
+        frameCopy(data, layout.uVarianceHist, frame, bins, result.uVarianceBins);
+        frameCopy(data, layout.vAverageHist, frame, bins, result.vAverageBins);
+        frameCopy(data, layout.vVarianceHist, frame, bins, result.vVarianceBins);
     }
-    vVarianceHistBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, numOfBins * sizeof(varhist), NULL, &clError);
-    if (showErrors && clError < 0) {
-        std::cout << "Create vVarianceHistBuffer ERROR: " << clError << std::endl;
+    else {
+        result.uAverageBins.assign(bins, 0);
+        result.uVarianceBins.assign(bins, 0);
+        result.vAverageBins.assign(bins, 0);
+        result.vVarianceBins.assign(bins, 0);
     }
 
-    // Initialize Hist Buffer
-    clError = commandQueue.enqueueWriteBuffer(yAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &yAverageBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading y_AverageHistBuffer ERROR: " << clError << std::endl;
+    // The details that are not read keep their size, so the result is laid out the same way for every detail
+    if (detail == Detail::Include) {
+        frameCopy(data, layout.yAverage, frame, blocks, result.yAverage);
+        frameCopy(data, layout.yVariance, frame, blocks, result.yVariance);
     }
-    clError = commandQueue.enqueueWriteBuffer(uAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &uAverageBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading u_AverageHistBuffer ERROR: " << clError << std::endl;
+    else {
+        result.yAverage.resize(blocks);
+        result.yVariance.resize(blocks);
     }
-    clError = commandQueue.enqueueWriteBuffer(vAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &vAverageBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading v_AverageHistBuffer ERROR: " << clError << std::endl;
+    if (detail == Detail::Include && numOfChannels == 3) {
+        frameCopy(data, layout.uAverage, frame, blocks, result.uAverage);
+        frameCopy(data, layout.uVariance, frame, blocks, result.uVariance);
+        frameCopy(data, layout.vAverage, frame, blocks, result.vAverage);
+        frameCopy(data, layout.vVariance, frame, blocks, result.vVariance);
     }
-    clError = commandQueue.enqueueWriteBuffer(yVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &yVarianceBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading y_VarianceHistBuffer ERROR: " << clError << std::endl;
+    else {
+        result.uAverage.resize(blocks);
+        result.uVariance.resize(blocks);
+        result.vAverage.resize(blocks);
+        result.vVariance.resize(blocks);
     }
-    clError = commandQueue.enqueueWriteBuffer(uVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &uVarianceBins[0], NULL, NULL);
+}
+
+void Histogram::readOutputBuffers(BufferSet &set, Detail detail, void *ptr, cl::Event *event) {
+    clError = set.queue.enqueueReadBuffer(set.outputBuffer, CL_FALSE, 0, outputReadSize(set.layout, detail), ptr, NULL, event);
     if (showErrors && clError < 0) {
-        std::cout << "Reading u_VarianceHistBuffer ERROR: " << clError << std::endl;
+        std::cout << "Reading outputBuffer ERROR: " << clError << std::endl;
     }
-    clError = commandQueue.enqueueWriteBuffer(vVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &vVarianceBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading v_VarianceHistBuffer ERROR: " << clError << std::endl;
+}
+
+size_t Histogram::outputReadSize(const OutputLayout &layout, Detail detail) {
+    // The outputs of the chroma channels are left out when they are not calculated
+    if (detail == Detail::Include) {
+        return (color == Color::Chromatic) ? layout.size : layout.uAverage;
     }
+    return (color == Color::Chromatic) ? layout.yAverage : layout.uAverageHist;
 }
 
-void Histogram::calculateSizes() {
-    ySize = imgWidth * imgHeight;
-    uSize = (imgWidth/2) * (imgHeight/2);
-    vSize = (imgWidth/2) * (imgHeight/2);
-    imageSize = ySize + uSize + vSize;
+std::future<Histogram::Result> Histogram::submit(const void *ptr, Detail detail) {
+    return submit(tightPlanes(ptr), detail);
+}
 
-    yBlockWidth = blockWidth;
-    yBlockHeight = blockHeight;
-    yBlockSize = yBlockWidth * yBlockHeight;
-    yNumOfBlocks = (imgWidth/yBlockWidth) * (imgHeight/yBlockHeight);
+std::future<Histogram::Result> Histogram::submit(const std::vector<Plane> &planes, Detail detail) {
+    if (!environmentSetUp) {
+        std::cout << "Environment not set up" << std::endl;
+        return std::future<Result>();
+    }
+    if (!validPlanes(planes)) {
+        return std::future<Result>();
+    }
 
-    uBlockWidth = blockWidth/2;
-    uBlockHeight = blockHeight/2;
-    uBlockSize = uBlockWidth * uBlockHeight;
-    uNumOfBlocks = ((imgWidth/2)/uBlockWidth) * ((imgHeight/2)/uBlockHeight);
+    // The CPU backend calculates the frame before returning, so its memory can be reused
+    if (cpuBackend) {
+        std::shared_ptr<Result> result = std::make_shared<Result>();
+        calculateFrameCPU(planes, detail, *result, NULL);
+        return std::async(std::launch::deferred, [result]() {
+            return std::move(*result);
+        });
+    }
+    if (!kernelsLoaded) {
+        loadKernels();
+    }
 
-    vBlockWidth = blockWidth/2;
-    vBlockHeight = blockHeight/2;
-    vBlockSize = vBlockWidth * vBlockHeight;
-    vNumOfBlocks = ((imgWidth/2)/vBlockWidth) * ((imgHeight/2)/vBlockHeight);
+    // Create the ring of buffer sets on the first submission
+    if (ring.empty()) {
+        createRing();
+    }
+    BufferSet &set = ring[ringIndex];
+    ringIndex = (ringIndex + 1) % ring.size();
 
-    globalRange = cl::NDRange(adjustDimension(imgWidth/2, yBlockWidth/2), adjustDimension(imgHeight/2, yBlockHeight/2));
-    localRange = cl::NDRange(yBlockWidth/2, yBlockHeight/2);
-}
+    // Wait until the previous frame of this buffer set has been read back
+    if (set.event() != NULL) {
+        set.event.wait();
+    }
 
-void Histogram::calculateHistograms() {
-    if (!environmentSetUp) {
-        std::cout << "Environment not set up" << std::endl;
-        return;
+    // The upload is blocking, so the frame memory can be reused as soon as this returns
+    writeInputBuffers(set, planes, numOfBlocksY);
+    resetHistBuffers(set);
+
+    cl::Event kernelEvent;
+    cl::Kernel kernel = setKernelArgs(set, detail);
+    clError = set.queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange, NULL, &kernelEvent);
+    if (showErrors && clError < 0) {
+        std::cout << "Execution ERROR: " << clError << std::endl;
     }
-    calculateHistograms(Detail::Exclude);
+    finishHistograms(set, numOfBlocksY);
+
+    // Every frame is read with a single transfer to its own host memory, so the buffer set can be reused before its result is requested
+    // The buffer set keeps the memory until the read is finished, even if the future is dropped before
+    std::shared_ptr<std::vector<char>> hostOutput = std::make_shared<std::vector<char>>(outputReadSize(set.layout, detail));
+    set.pendingOutput = hostOutput;
+    readOutputBuffers(set, detail, hostOutput->data(), &set.event);
+    set.queue.flush();
+
+    // The future waits for the read back of the frame when its result is requested, and copies the outputs to the result
+    cl::Event readEvent = set.event;
+    OutputLayout layout = set.layout;
+    int numOfChannels = (color == Color::Chromatic) ? 3 : 1;
+    return std::async(std::launch::deferred, [hostOutput, layout, numOfChannels, detail, kernelEvent, readEvent]() {
+        readEvent.wait();
+        Result result;
+        unpackOutputs(layout, hostOutput->data(), numOfChannels, detail, result, 0);
+        result.elapsedTime = (1e-6) * (kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+        return result;
+    });
 }
 
-void Histogram::calculateHistograms(Detail detail) {
+std::vector<Histogram::Result> Histogram::calculateBatch(const void *ptr, int numOfFrames, Detail detail) {
+    std::vector<Result> results;
     if (!environmentSetUp) {
         std::cout << "Environment not set up" << std::endl;
-        return;
+        return results;
     }
-
-    // Reset Timers
-    elapsedTime = 0;
-
-    cl::Event event;
-    cl::Kernel kernel;
-    
-    // Set Kernel Args
-    if (color == Color::Chromatic) {
-        if (detail == Detail::Exclude) {
-            kernel = histogramsKernel;
-            kernel.setArg(0, imageBuffer);
-            kernel.setArg(1, numOfBinsBuffer);
-            kernel.setArg(2, formatBuffer);
-            kernel.setArg(3, yAverageHistBuffer);
-            kernel.setArg(4, yVarianceHistBuffer);
-            kernel.setArg(5, uAverageHistBuffer);
-            kernel.setArg(6, uVarianceHistBuffer);
-            kernel.setArg(7, vAverageHistBuffer);
-            kernel.setArg(8, vVarianceHistBuffer);
-            kernel.setArg(9, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(10, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(11, uBlockSize * sizeof(int), NULL);
-            kernel.setArg(12, uBlockSize * sizeof(int), NULL);
-            kernel.setArg(13, vBlockSize * sizeof(int), NULL);
-            kernel.setArg(14, vBlockSize * sizeof(int), NULL);
+    if (!kernelsLoaded) {
+        loadKernels();
+    }
+    if (numOfFrames < 1) {
+        if (showErrors) {
+            std::cout << "Batch ERROR: invalid number of frames " << numOfFrames << std::endl;
         }
-        else {
-            kernel = histogramsDetailKernel;
-            kernel.setArg(0, imageBuffer);
-            kernel.setArg(1, numOfBinsBuffer);
-            kernel.setArg(2, formatBuffer);
-            kernel.setArg(3, yAverageBuffer);
-            kernel.setArg(4, yVarianceBuffer);
-            kernel.setArg(5, yAverageHistBuffer);
-            kernel.setArg(6, yVarianceHistBuffer);
-            kernel.setArg(7, uAverageBuffer);
-            kernel.setArg(8, uVarianceBuffer);
-            kernel.setArg(9, uAverageHistBuffer);
-            kernel.setArg(10, uVarianceHistBuffer);
-            kernel.setArg(11, vAverageBuffer);
-            kernel.setArg(12, vVarianceBuffer);
-            kernel.setArg(13, vAverageHistBuffer);
-            kernel.setArg(14, vVarianceHistBuffer);
-            kernel.setArg(15, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(16, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(17, uBlockSize * sizeof(int), NULL);
-            kernel.setArg(18, uBlockSize * sizeof(int), NULL);
-            kernel.setArg(19, vBlockSize * sizeof(int), NULL);
-            kernel.setArg(20, vBlockSize * sizeof(int), NULL);
+        return results;
+    }
+
+    // The CPU backend calculates the frames one after another, each one with every thread
+    if (cpuBackend) {
+        elapsedTime = 0;
+        for (int frame = 0; frame < numOfFrames; frame++) {
+            Result result;
+            calculateFrameCPU(tightPlanes((const char *)ptr + (size_t)frame * imageSize * sampleSize), detail, result, NULL);
+            elapsedTime += result.elapsedTime;
+            results.push_back(std::move(result));
         }
+        return results;
+    }
+
+    // The batch buffers hold every frame, they are kept while the number of frames does not change
+    if (batch.queue() == NULL || batch.numOfFrames != numOfFrames) {
+        batch.queue = buffers.queue;
+        batch.numOfFrames = numOfFrames;
+        createInputBuffers(batch);
+        createOutputBuffers(batch);
     }
     else {
-        if (detail == Detail::Exclude) {
-            kernel = singleChannelKernel;
-            kernel.setArg(0, imageBuffer);
-            kernel.setArg(1, numOfBinsBuffer);
-            kernel.setArg(2, yAverageHistBuffer);
-            kernel.setArg(3, yVarianceHistBuffer);
-            kernel.setArg(4, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(5, yBlockSize * sizeof(int), NULL);
-        }
-        else {
-            kernel = singleChannelDetailKernel;
-            kernel.setArg(0, imageBuffer);
-            kernel.setArg(1, numOfBinsBuffer);
-            kernel.setArg(2, yAverageBuffer);
-            kernel.setArg(3, yVarianceBuffer);
-            kernel.setArg(4, yAverageHistBuffer);
-            kernel.setArg(5, yVarianceHistBuffer);
-            kernel.setArg(6, yBlockSize * sizeof(int), NULL);
-            kernel.setArg(7, yBlockSize * sizeof(int), NULL);
-        }
-    }
-    clError = commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange, NULL, &event);
-    event.wait();
-    if (showErrors && clError < 0) {
-        std::cout << "Execution ERROR: " << clError << std::endl;
+        resetHistBuffers(batch);
     }
-    elapsedTime = (1e-6) * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
-    
+    writeBatchBuffers(batch, ptr);
 
-    // Read responsess
-    if (detail == Detail::Include) 
-    {
-        clError = commandQueue.enqueueReadBuffer(yAverageBuffer, CL_TRUE, 0, yNumOfBlocks * sizeof(float), &yAverage[0], NULL, NULL);
-        if (showErrors && clError < 0) {
-            std::cout << "Reading yAverageBuffer ERROR: " << clError << std::endl;
-        }
-        clError = commandQueue.enqueueReadBuffer(yVarianceBuffer, CL_TRUE, 0, yNumOfBlocks * sizeof(float), &yVariance[0], NULL, NULL);
-        if (showErrors && clError < 0) {
-            std::cout << "Reading yVarianceBuffer ERROR: " << clError << std::endl;
-        }
-        if (color == Color::Chromatic) {
-            clError = commandQueue.enqueueReadBuffer(uAverageBuffer, CL_TRUE, 0, uNumOfBlocks * sizeof(float), &uAverage[0], NULL, NULL);
-            if (showErrors && clError < 0) {
-                std::cout << "Reading uAverageBuffer ERROR: " << clError << std::endl;
-            }
-            clError = commandQueue.enqueueReadBuffer(uVarianceBuffer, CL_TRUE, 0, uNumOfBlocks * sizeof(float), &uVariance[0], NULL, NULL);
-            if (showErrors && clError < 0) {
-                std::cout << "Reading uVarianceBuffer ERROR: " << clError << std::endl;
-            }
+    // Reset Timers
+    elapsedTime = 0;
 
-            clError = commandQueue.enqueueReadBuffer(vAverageBuffer, CL_TRUE, 0, vNumOfBlocks * sizeof(float), &vAverage[0], NULL, NULL);
-            if (showErrors && clError < 0) {
-                std::cout << "Reading vAverageBuffer ERROR: " << clError << std::endl;
-            }
-            clError = commandQueue.enqueueReadBuffer(vVarianceBuffer, CL_TRUE, 0, vNumOfBlocks * sizeof(float), &vVariance[0], NULL, NULL);
-            if (showErrors && clError < 0) {
-                std::cout << "Reading vVarianceBuffer ERROR: " << clError << std::endl;
-            }  
+    // Every frame is a slice of work groups along the third dimension
+    cl::Event event;
+    cl::NDRange batchGlobalRange(globalRange.get()[0], globalRange.get()[1], numOfFrames);
+    cl::NDRange batchLocalRange(localRange.get()[0], localRange.get()[1], 1);
+    cl::Kernel kernel = setKernelArgs(batch, detail);
+    clError = batch.queue.enqueueNDRangeKernel(kernel, cl::NullRange, batchGlobalRange, batchLocalRange, NULL, &event);
+    if (clError < 0) {
+        if (showErrors) {
+            std::cout << "Execution ERROR: " << clError << std::endl;
         }
+        return results;
     }
+    finishHistograms(batch, numOfBlocksY);
 
-    clError = commandQueue.enqueueReadBuffer(yAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &yAverageBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading yAverageHistBuffer ERROR: " << clError << std::endl;
+    // The outputs of every frame are read with a single transfer enqueued behind the kernels, so the batch is waited for only once
+    const char *data = fetchOutputs(batch, detail, NULL, NULL);
+    if (data == NULL) {
+        return results;
     }
-    clError = commandQueue.enqueueReadBuffer(yVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &yVarianceBins[0], NULL, NULL);
-    if (showErrors && clError < 0) {
-        std::cout << "Reading yVarianceHistBuffer ERROR: " << clError << std::endl;
+    elapsedTime = (1e-6) * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+
+    // Split the outputs into the results of each frame
+    for (int frame = 0; frame < numOfFrames; frame++) {
+        Result result;
+        unpackOutputs(batch.layout, data, (color == Color::Chromatic) ? 3 : 1, detail, result, frame);
+        result.elapsedTime = elapsedTime / numOfFrames;
+        results.push_back(std::move(result));
     }
+    unmapOutputBuffer(batch);
+    return results;
+}
 
-    if (color == Color::Chromatic) {
-        clError = commandQueue.enqueueReadBuffer(uAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &uAverageBins[0], NULL, NULL);
-        if (showErrors && clError < 0) {
-            std::cout << "Reading uAverageHistBuffer ERROR: " << clError << std::endl;
-        }
-        clError = commandQueue.enqueueReadBuffer(vAverageHistBuffer, CL_TRUE, 0, numOfBins * sizeof(int), &vAverageBins[0], NULL, NULL);
-        if (showErrors && clError < 0) {
-            std::cout << "Reading vAverageHistBuffer ERROR: " << clError << std::endl;
-        }
-        clError = commandQueue.enqueueReadBuffer(uVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &uVarianceBins[0], NULL, NULL);
+void Histogram::createRing() {
+    ring = std::vector<BufferSet>(inFlightFrames);
+    for (BufferSet &set : ring) {
+        // Every buffer set has its own queue, so the transfers and kernels of different frames can overlap
+        set.queue = cl::CommandQueue(context, defaultDevice, cl::QueueProperties::Profiling, &clError);
         if (showErrors && clError < 0) {
-            std::cout << "Reading uVarianceHistBuffer ERROR: " << clError << std::endl;
+            std::cout << "Queue ERROR: " << clError << std::endl;
         }
-        clError = commandQueue.enqueueReadBuffer(vVarianceHistBuffer, CL_TRUE, 0, numOfBins * sizeof(varhist), &vVarianceBins[0], NULL, NULL);
-        if (showErrors && clError < 0) {
-            std::cout << "Reading vVarianceHistBuffer ERROR: " << clError << std::endl;
+        createInputBuffers(set);
+        createOutputBuffers(set);
+    }
+    ringIndex = 0;
+}
+
+void Histogram::clearRing() {
+    for (BufferSet &set : ring) {
+        if (set.event() != NULL) {
+            set.event.wait();
         }
     }
+    ring.clear();
 }
 
 std::vector<float> Histogram::getAverage(Channel channel) {
-    if (channel == Channel::Y) {
-        return yAverage;
+    View<float> values = viewAverage(channel);
+    return std::vector<float>(values.begin(), values.end());
+}
+
+std::vector<float> Histogram::getVariance(Channel channel) {
+    View<float> values = viewVariance(channel);
+    return std::vector<float>(values.begin(), values.end());
+}
+
+std::vector<int> Histogram::getAverageHistogram(Channel channel) {
+    View<int> values = viewAverageHistogram(channel);
+    return std::vector<int>(values.begin(), values.end());
+}
+
+std::vector<varhist> Histogram::getVarianceHistogram(Channel channel) {
+    View<varhist> values = viewVarianceHistogram(channel);
+    return std::vector<varhist>(values.begin(), values.end());
+}
+
+template <typename T>
+Histogram::View<T> Histogram::outputView(const std::vector<T> &values, size_t offset) {
+    if (fusedOutput != NULL) {
+        return {reinterpret_cast<const T *>(fusedOutput + offset), values.size()};
     }
-    else if (channel == Channel::U) {
-        return uAverage;
+    return {values.data(), values.size()};
+}
+
+Histogram::View<float> Histogram::viewAverage(Channel channel) {
+    if (channel == Channel::U) {
+        return outputView(output.uAverage, buffers.layout.uAverage);
     }
     else if (channel == Channel::V) {
-        return vAverage;
+        return outputView(output.vAverage, buffers.layout.vAverage);
     }
-    return yAverage;
+    return outputView(output.yAverage, buffers.layout.yAverage);
 }
 
-std::vector<float> Histogram::getVariance(Channel channel) {
-    if (channel == Channel::Y) {
-        return yVariance;
-    }
-    else if (channel == Channel::U) {
-        return uVariance;
+Histogram::View<float> Histogram::viewVariance(Channel channel) {
+    if (channel == Channel::U) {
+        return outputView(output.uVariance, buffers.layout.uVariance);
     }
     else if (channel == Channel::V) {
-        return vVariance;
+        return outputView(output.vVariance, buffers.layout.vVariance);
     }
-    return yVariance;
+    return outputView(output.yVariance, buffers.layout.yVariance);
 }
 
-std::vector<int> Histogram::getAverageHistogram(Channel channel) {
-    if (channel == Channel::Y) {
-        return yAverageBins;
-    }
-    else if (channel == Channel::U) {
-        return uAverageBins;
+Histogram::View<int> Histogram::viewAverageHistogram(Channel channel) {
+    if (channel == Channel::U) {
+        return outputView(output.uAverageBins, buffers.layout.uAverageHist);
     }
     else if (channel == Channel::V) {
-        return vAverageBins;
+        return outputView(output.vAverageBins, buffers.layout.vAverageHist);
     }
-    return yAverageBins;
+    return outputView(output.yAverageBins, buffers.layout.yAverageHist);
 }
 
-std::vector<varhist> Histogram::getVarianceHistogram(Channel channel) {
-    if (channel == Channel::Y) {
-        return yVarianceBins;
-    }
-    else if (channel == Channel::U) {
-        return uVarianceBins;
+Histogram::View<varhist> Histogram::viewVarianceHistogram(Channel channel) {
+    if (channel == Channel::U) {
+        return outputView(output.uVarianceBins, buffers.layout.uVarianceHist);
     }
     else if (channel == Channel::V) {
-        return vVarianceBins;
+        return outputView(output.vVarianceBins, buffers.layout.vVarianceHist);
+    }
+    return outputView(output.yVarianceBins, buffers.layout.yVarianceHist);
+}
+
+void Histogram::setOutputMemory(void *ptr, size_t size) {
+    outputMemory = ptr;
+    outputMemorySize = (ptr != NULL) ? size : 0;
+}
+
+size_t Histogram::getOutputMemorySize() {
+    return buffers.layout.size;
+}
+
+std::vector<cl_ulong> Histogram::getAccumulatedAverageHistogram(Channel channel) {
+    return readAccumulation(channel, false);
+}
+
+std::vector<double> Histogram::getAccumulatedVarianceHistogram(Channel channel) {
+    std::vector<cl_ulong> fixedBins = readAccumulation(channel, true);
+    std::vector<double> bins(numOfBins);
+    double scale = 1.0 / (double)(1 << ((bitDepth() > 8) ? 8 : 16));
+    for (int bin = 0; bin < numOfBins; bin++) {
+        bins[bin] = (double)fixedBins[bin] * scale;
     }
-    return yVarianceBins;
+    return bins;
+}
+
+int Histogram::getAccumulatedFrames() {
+    return accumulatedFrames;
 }
 
 double Histogram::getElapsedTime() {
     return elapsedTime;
 }
 
+Histogram::Backend Histogram::getLastBackend() {
+    return lastBackend;
+}
+
 void Histogram::printEnvironment() {
     if (!environmentSetUp) {
         std::cout << "Environment not set up" << std::endl;
         return;
     }
+    if (cpuBackend) {
+        std::cout << "Device name: CPU backend (" << cpuThreads() << " threads, " << instructionSet() << ")" << std::endl;
+        return;
+    }
+    if (hybridBackend || adaptiveBackend) {
+        std::cout << (hybridBackend ? "Hybrid" : "Adaptive") << " with CPU backend (" << cpuThreads() << " threads, " << instructionSet() << ")" << std::endl;
+    }
     std::cout << "Platform name: " << platform.getInfo<CL_PLATFORM_NAME>() << std::endl;
-    std::cout << "Device name: " << devices[0].getInfo<CL_DEVICE_NAME>() << std::endl;
-    std::cout << "Device OpenCL Version: " << devices[0].getInfo<CL_DEVICE_VERSION>() << std::endl;
-    std::cout << "Device OpenCL C Version: " << devices[0].getInfo<CL_DEVICE_OPENCL_C_VERSION>() << std::endl;
+    std::cout << "Device name: " << defaultDevice.getInfo<CL_DEVICE_NAME>() << std::endl;
+    std::cout << "Device compute units: " << defaultDevice.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() << std::endl;
+    std::cout << "Device OpenCL Version: " << defaultDevice.getInfo<CL_DEVICE_VERSION>() << std::endl;
+    std::cout << "Device OpenCL C Version: " << defaultDevice.getInfo<CL_DEVICE_OPENCL_C_VERSION>() << std::endl;
+}
+
+int Histogram::bitDepth() {
+    switch (format) {
+        case Format::I010:
+        case Format::P010:
+            return 10;
+        case Format::I012:
+        case Format::P012:
+            return 12;
+        case Format::I016:
+        case Format::P016:
+            return 16;
+        default:
+            return 8;
+    }
+}
+
+int Histogram::chromaSubsamplingX() {
+    if (format == Format::I444) {
+        return 1;
+    }
+    return 2;
+}
+
+int Histogram::chromaSubsamplingY() {
+    switch (format) {
+        case Format::I422:
+        case Format::I444:
+        case Format::YUYV:
+        case Format::UYVY:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+int Histogram::lumaPixelStride() {
+    // Packed formats interleave a chroma sample after every luma sample
+    return (numOfPlanes() == 1) ? 2 : 1;
+}
+
+int Histogram::chromaPixelStride() {
+    switch (numOfPlanes()) {
+        case 1:
+            return 4;
+        case 2:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+int Histogram::sampleShift() {
+    if (format == Format::P010 || format == Format::P012) {
+        return 16 - bitDepth();
+    }
+    return 0;
 }
 
-int Histogram::adjustDimension(int dimension, int blockDimension) {
+std::string Histogram::buildOptions() {
+    std::string options = "-cl-std=CL3.0";
+    if (input == Input::Native) {
+        options += (bitDepth() > 8) ? " -D PIXEL_TYPE=ushort" : " -D PIXEL_TYPE=uchar";
+    }
+    options += " -D BIT_DEPTH=" + std::to_string(bitDepth());
+    options += " -D SAMPLE_SHIFT=" + std::to_string(sampleShift());
+    options += " -D WIDE_ACCUMULATORS=" + std::to_string(wideAccumulators() ? 1 : 0);
+    options += " -D SUB_GROUP_REDUCE=" + std::to_string(subGroupReduce ? 1 : 0);
+    options += " -D WORK_GROUP_REDUCE=" + std::to_string(workGroupReduce ? 1 : 0);
+    options += int64Atomics ? " -D INT64_ATOMICS=1" : " -D INT64_ATOMICS=0";
+    options += " -D TWO_STAGE_REDUCE=" + std::to_string(reduction == Reduction::TwoStage ? 1 : 0);
+
+    // Configuration the kernels are specialized for
+    options += " -D NUM_OF_BINS=" + std::to_string(numOfBins);
+    options += " -D BLOCK_WIDTH=" + std::to_string(blockWidth);
+    options += " -D BLOCK_HEIGHT=" + std::to_string(blockHeight);
+    options += " -D CHROMA_SUBSAMPLING_X=" + std::to_string(chromaSubsamplingX());
+    options += " -D CHROMA_SUBSAMPLING_Y=" + std::to_string(chromaSubsamplingY());
+    options += " -D Y_PIXEL_STRIDE=" + std::to_string(lumaPixelStride());
+    options += " -D CHROMA_PIXEL_STRIDE=" + std::to_string(chromaPixelStride());
+    options += " -D EDGE_POLICY=" + std::to_string(static_cast<int>(edge));
+    options += " -D LOCAL_SIZE=" + std::to_string(localSize);
+    options += " -D ITEMS_PER_BLOCK=" + std::to_string(itemsPerBlock);
+    options += " -D BLOCKS_PER_GROUP=" + std::to_string(groupBlocks);
+    return options;
+}
+
+bool Histogram::wideAccumulators() {
+    return bitDepth() == 8 && (long long)blockWidth * blockHeight * 255 * 255 > std::numeric_limits<int>::max();
+}
+
+bool Histogram::validBlockSize(int blockWidth, int blockHeight) {
+    // The variance of a high bit depth block is calculated as count * sumSquares - sum * sum, which must fit in 64 bits
+    long long maxSample = (1LL << bitDepth()) - 1;
+    long long maxPixels = (bitDepth() > 8) ? (long long)std::numeric_limits<uint32_t>::max() / maxSample : std::numeric_limits<int>::max();
+    if ((long long)blockWidth * blockHeight > maxPixels) {
+        if (showErrors) {
+            std::cout << "Block Size ERROR: blocks of " << bitDepth() << " bit samples hold at most " << maxPixels << " pixels" << std::endl;
+        }
+        return false;
+    }
+    return true;
+}
+
+int Histogram::numOfBlocks(int dimension, int blockDimension) {
     if (blockDimension == 0) {
-        return dimension;
+        return 0;
     }
-    return dimension - (dimension % blockDimension);
+    // Partial edge blocks are only kept if the edge policy calculates them
+    if (edge == Edge::Discard) {
+        return dimension / blockDimension;
+    }
+    return (dimension + blockDimension - 1) / blockDimension;
 }
 
 void Histogram::setImageSize(int imgWidth, int imgHeight) {
@@ -498,25 +2023,154 @@ void Histogram::setImageSize(int imgWidth, int imgHeight) {
     
     // Recalculate sizes and reset buffers
     calculateSizes();
-    createInputBuffers();
-    createOutputVectors();
-    createOutputBuffers();
-
+    createOutputVectors(output, 1);
+    if (!cpuBackend) {
+        createInputBuffers(buffers);
+        createOutputBuffers(buffers);
+    }
+    clearRing();
+    batch = BufferSet();
 }
 
 void Histogram::setBlockSize(int blockWidth, int blockHeight) {
+    if (!validBlockSize(blockWidth, blockHeight)) {
+        return;
+    }
+
     // Change settings
     this->blockWidth = blockWidth;
     this->blockHeight = blockHeight;
 
     // Recalculate sizes and reset buffers
     calculateSizes();
-    createOutputVectors();
-    createOutputBuffers();
+    createOutputVectors(output, 1);
+    if (!cpuBackend) {
+        createOutputBuffers(buffers);
+    }
+    clearRing();
+    batch = BufferSet();
+    kernelsLoaded = false;
+}
+
+void Histogram::setEdge(Edge edge) {
+    this->edge = edge;
+
+    // Recalculate sizes and reset buffers if the environment is already set up
+    if (environmentSetUp) {
+        calculateSizes();
+        createOutputVectors(output, 1);
+        if (!cpuBackend) {
+            createOutputBuffers(buffers);
+        }
+        clearRing();
+        batch = BufferSet();
+    }
+    kernelsLoaded = false;
+}
+
+void Histogram::setMemory(Memory memory) {
+    this->memory = memory;
+}
+
+void Histogram::setBackend(Backend backend) {
+    this->backend = backend;
+}
+
+void Histogram::setThreads(int threads) {
+    this->threads = std::max(threads, 0);
+
+    // The pool is started again with the new number of threads when it is next used
+    workers.reset();
+}
+
+void Histogram::setPlatform(const std::string &name) {
+    platformName = name;
+}
+
+void Histogram::setDevice(DeviceType type, const std::string &name, int index) {
+    deviceType = type;
+    deviceName = name;
+    deviceIndex = std::max(index, 0);
+}
+
+void Histogram::setSubDevice(int computeUnits, int index) {
+    subDeviceUnits = std::max(computeUnits, 0);
+    subDeviceIndex = std::max(index, 0);
+}
+
+void Histogram::setReduction(Reduction reduction) {
+    this->reduction = reduction;
+    kernelsLoaded = false;
+}
+
+void Histogram::setAccumulation(Accumulation accumulation) {
+    this->accumulation = accumulation;
+}
+
+void Histogram::resetAccumulation() {
+    accumulatedFrames = 0;
+    hostTotals.assign(6 * numOfBins, 0);
+    if (cpuBackend || totalBuffer() == NULL) {
+        return;
+    }
+    cl_ulong zero = 0;
+    clError = buffers.queue.enqueueFillBuffer(totalBuffer, zero, 0, 6 * numOfBins * sizeof(cl_ulong), NULL, NULL);
+    if (showErrors && clError < 0) {
+        std::cout << "Reset totalBuffer ERROR: " << clError << std::endl;
+    }
 }
 
 void Histogram::setNumofBins(int numOfBins) {
     this->numOfBins = numOfBins;
+
+    // Recalculate sizes and reset buffers if the environment is already set up
+    if (environmentSetUp) {
+        calculateSizes();
+        createOutputVectors(output, 1);
+        if (!cpuBackend) {
+            createOutputBuffers(buffers);
+            createTotalBuffer();
+            if (buffers.numOfBinsBuffer() != NULL) {
+                writeBuffer(buffers.queue, buffers.numOfBinsBuffer, 0, 1 * sizeof(int), &this->numOfBins, "numOfBinsBuffer");
+            }
+        }
+        resetAccumulation();
+    }
+    clearRing();
+    batch = BufferSet();
+    kernelsLoaded = false;
+}
+
+void Histogram::setInFlightFrames(int frames) {
+    inFlightFrames = std::max(frames, 1);
+    clearRing();
+    batch = BufferSet();
+}
+
+void Histogram::setBlocksPerGroup(int blocks) {
+    blocksPerGroup = std::max(blocks, 1);
+    calculateSizes();
+    kernelsLoaded = false;
+}
+
+void Histogram::setWorkGroupSize(int size) {
+    workGroupSize = std::max(size, 0);
+    calculateSizes();
+    kernelsLoaded = false;
+}
+
+void Histogram::setPixelsPerItem(int pixels) {
+    pixelsPerItem = std::max(pixels, 1);
+    calculateSizes();
+    kernelsLoaded = false;
+}
+
+void Histogram::setCacheDirectory(const std::string &directory) {
+    cacheDirectory = directory;
+}
+
+void Histogram::setTuningFile(const std::string &file) {
+    tuningFile = file;
 }
 
 void Histogram::setErrorLevel(ErrorLevel errorLevel) {
@@ -0,0 +1,494 @@
+#include "histogram.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// The vector functions are compiled for their instruction set whatever the target of the library, and only called when the processor supports it
+#if defined(X86_SIMD) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE4_1 __attribute__((target("sse4.1")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE4_1
+#endif
+
+/**
+ * @brief Instruction sets of the CPU backend, from the slowest to the fastest.
+ */
+enum class InstructionSet {
+    Scalar,
+    SSE4_1,
+    AVX2
+};
+
+/**
+ * @brief Detects the fastest instruction set supported by the processor and the operating system.
+ * 
+ * @return InstructionSet with the instruction set.
+ */
+static InstructionSet detectInstructionSet() {
+#if defined(X86_SIMD) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse4_1 = (info[2] & (1 << 19)) != 0;
+    // AVX2 also needs the operating system to save the YMM registers
+    bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (avx && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0) {
+            return InstructionSet::AVX2;
+        }
+    }
+    return sse4_1 ? InstructionSet::SSE4_1 : InstructionSet::Scalar;
+#elif defined(X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return InstructionSet::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return InstructionSet::SSE4_1;
+    }
+    return InstructionSet::Scalar;
+#else
+    return InstructionSet::Scalar;
+#endif
+}
+
+/**
+ * @brief Helper function used to get the instruction set of the CPU backend, detected once.
+ * 
+ * @return InstructionSet with the instruction set.
+ */
+static InstructionSet cpuInstructionSet() {
+    static const InstructionSet instructionSet = detectInstructionSet();
+    return instructionSet;
+}
+
+#if defined(X86_SIMD)
+/**
+ * @brief Adds the samples of an 8 bit row and their squares to the sums of each column with AVX2.
+ * 
+ * @return int with the number of samples added, the rest are added by the scalar code.
+ */
+TARGET_AVX2 static int accumulateRowAVX2(const uint8_t *row, int count, int *sums, int *squares) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i samples = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + i)));
+        __m256i rowSums = _mm256_loadu_si256((const __m256i *)(sums + i));
+        __m256i rowSquares = _mm256_loadu_si256((const __m256i *)(squares + i));
+        _mm256_storeu_si256((__m256i *)(sums + i), _mm256_add_epi32(rowSums, samples));
+        _mm256_storeu_si256((__m256i *)(squares + i), _mm256_add_epi32(rowSquares, _mm256_mullo_epi32(samples, samples)));
+    }
+    return i;
+}
+
+/**
+ * @brief Adds the samples of an 8 bit row and their squares to the sums of each column with SSE4.1.
+ * 
+ * @return int with the number of samples added, the rest are added by the scalar code.
+ */
+TARGET_SSE4_1 static int accumulateRowSSE4_1(const uint8_t *row, int count, int *sums, int *squares) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int packed;
+        std::memcpy(&packed, row + i, sizeof(int));
+        __m128i samples = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+        __m128i rowSums = _mm_loadu_si128((const __m128i *)(sums + i));
+        __m128i rowSquares = _mm_loadu_si128((const __m128i *)(squares + i));
+        _mm_storeu_si128((__m128i *)(sums + i), _mm_add_epi32(rowSums, samples));
+        _mm_storeu_si128((__m128i *)(squares + i), _mm_add_epi32(rowSquares, _mm_mullo_epi32(samples, samples)));
+    }
+    return i;
+}
+
+/**
+ * @brief Adds the samples of a high bit depth row and their squares to the sums of each column with AVX2.
+ * 
+ * @return int with the number of samples added, the rest are added by the scalar code.
+ */
+TARGET_AVX2 static int accumulateRowAVX2(const uint16_t *row, int count, int shift, cl_ulong *sums, cl_ulong *squares) {
+    int i = 0;
+    __m128i vectorShift = _mm_cvtsi32_si128(shift);
+    for (; i + 4 <= count; i += 4) {
+        __m256i samples = _mm256_srl_epi64(_mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)(row + i))), vectorShift);
+        __m256i rowSums = _mm256_loadu_si256((const __m256i *)(sums + i));
+        __m256i rowSquares = _mm256_loadu_si256((const __m256i *)(squares + i));
+        _mm256_storeu_si256((__m256i *)(sums + i), _mm256_add_epi64(rowSums, samples));
+        _mm256_storeu_si256((__m256i *)(squares + i), _mm256_add_epi64(rowSquares, _mm256_mul_epu32(samples, samples)));
+    }
+    return i;
+}
+
+/**
+ * @brief Adds the samples of a high bit depth row and their squares to the sums of each column with SSE4.1.
+ * 
+ * @return int with the number of samples added, the rest are added by the scalar code.
+ */
+TARGET_SSE4_1 static int accumulateRowSSE4_1(const uint16_t *row, int count, int shift, cl_ulong *sums, cl_ulong *squares) {
+    int i = 0;
+    __m128i vectorShift = _mm_cvtsi32_si128(shift);
+    for (; i + 2 <= count; i += 2) {
+        int packed;
+        std::memcpy(&packed, row + i, sizeof(int));
+        __m128i samples = _mm_srl_epi64(_mm_cvtepu16_epi64(_mm_cvtsi32_si128(packed)), vectorShift);
+        __m128i rowSums = _mm_loadu_si128((const __m128i *)(sums + i));
+        __m128i rowSquares = _mm_loadu_si128((const __m128i *)(squares + i));
+        _mm_storeu_si128((__m128i *)(sums + i), _mm_add_epi64(rowSums, samples));
+        _mm_storeu_si128((__m128i *)(squares + i), _mm_add_epi64(rowSquares, _mm_mul_epu32(samples, samples)));
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Adds the samples of a row and their squares to the sums of each column, the vertical sums of a row of blocks.
+ * 8 bit rows with int sums and high bit depth rows use the instruction set of the processor, the rest of the samples are added by scalar code.
+ * 
+ * @param row the samples of the row.
+ * @param count the number of samples of the row.
+ * @param shift the shift that aligns the samples to the least significant bit.
+ * @param sums the sums of each column.
+ * @param squares the sums of the squares of each column.
+ */
+template <typename T, typename A>
+static void accumulateRow(const T *row, int count, int shift, A *sums, A *squares) {
+    int i = 0;
+#if defined(X86_SIMD)
+    if constexpr ((std::is_same<T, uint8_t>::value && std::is_same<A, int>::value) || (std::is_same<T, uint16_t>::value && std::is_same<A, cl_ulong>::value)) {
+        InstructionSet instructionSet = cpuInstructionSet();
+        if constexpr (std::is_same<T, uint8_t>::value) {
+            // 8 bit samples are never shifted
+            if (instructionSet == InstructionSet::AVX2) {
+                i = accumulateRowAVX2(row, count, sums, squares);
+            }
+            else if (instructionSet == InstructionSet::SSE4_1) {
+                i = accumulateRowSSE4_1(row, count, sums, squares);
+            }
+        }
+        else {
+            if (instructionSet == InstructionSet::AVX2) {
+                i = accumulateRowAVX2(row, count, shift, sums, squares);
+            }
+            else if (instructionSet == InstructionSet::SSE4_1) {
+                i = accumulateRowSSE4_1(row, count, shift, sums, squares);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        A sample = (A)(row[i] >> shift);
+        sums[i] += sample;
+        squares[i] += sample * sample;
+    }
+}
+
+void Histogram::writeHostImage(const std::vector<Plane> &planes) {
+    if (!validPlanes(planes)) {
+        setHostPlanes({});
+        return;
+    }
+
+    // Keep the pitch of each plane, so they are copied as they are
+    size_t imageBytes = 0;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        imageBytes += (size_t)planes[plane].pitch * planeHeight(plane);
+    }
+    hostImage.resize(imageBytes);
+
+    std::vector<Plane> copies;
+    size_t offset = 0;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        // The padding after the last row is not read
+        size_t planeSize = (size_t)planes[plane].pitch * (planeHeight(plane) - 1) + planeWidth(plane) * sampleSize;
+        std::memcpy(&hostImage[offset], planes[plane].data, planeSize);
+        copies.push_back({&hostImage[offset], planes[plane].pitch});
+        offset += (size_t)planes[plane].pitch * planeHeight(plane);
+    }
+    setHostPlanes(copies);
+}
+
+void Histogram::calculateFrameCPU(const std::vector<Plane> &planes, Detail detail, Result &result, std::vector<cl_ulong> *totals) {
+    createOutputVectors(result, 1);
+    result.elapsedTime = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<cl_ulong> fixedVarianceBins(3 * numOfBins);
+    calculateRowsCPU(planes, detail, result, 0, numOfBlocksY, fixedVarianceBins);
+    convertVarianceBins(fixedVarianceBins, result);
+
+    // Frames accumulated across the stream are added in fixed point, in the same layout as the totals of the device
+    if (totals != NULL) {
+        int *averageBins[3] = {result.yAverageBins.data(), result.uAverageBins.data(), result.vAverageBins.data()};
+        int numOfChannels = (color == Color::Chromatic) ? 3 : 1;
+        for (int channel = 0; channel < numOfChannels; channel++) {
+            for (int bin = 0; bin < numOfBins; bin++) {
+                (*totals)[2 * channel * numOfBins + bin] += averageBins[channel][bin];
+                (*totals)[(2 * channel + 1) * numOfBins + bin] += fixedVarianceBins[channel * numOfBins + bin];
+            }
+        }
+    }
+    result.elapsedTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Histogram::calculateRowsCPU(const std::vector<Plane> &planes, Detail detail, Result &result, int firstBlockY, int lastBlockY, std::vector<cl_ulong> &fixedVarianceBins) {
+    if (!validPlanes(planes)) {
+        return;
+    }
+
+    // Offsets and strides of each channel inside its plane
+    std::vector<int> rowStrides;
+    for (int plane = 0; plane < numOfPlanes(); plane++) {
+        rowStrides.push_back(planes[plane].pitch / sampleSize);
+    }
+    calculateFormatDescriptor(std::vector<int>(numOfPlanes(), 0), rowStrides);
+
+    // Sums of squares of high bit depth blocks and of large 8 bit blocks do not fit in 32 bits, as in the kernels
+    if (input == Input::Int) {
+        if (accumulatorSize == sizeof(cl_ulong)) {
+            calculateRowsCPU<int, cl_ulong>(planes, detail, result, firstBlockY, lastBlockY, fixedVarianceBins);
+        }
+        else {
+            calculateRowsCPU<int, int>(planes, detail, result, firstBlockY, lastBlockY, fixedVarianceBins);
+        }
+    }
+    else if (bitDepth() > 8) {
+        calculateRowsCPU<uint16_t, cl_ulong>(planes, detail, result, firstBlockY, lastBlockY, fixedVarianceBins);
+    }
+    else if (accumulatorSize == sizeof(cl_ulong)) {
+        calculateRowsCPU<uint8_t, cl_ulong>(planes, detail, result, firstBlockY, lastBlockY, fixedVarianceBins);
+    }
+    else {
+        calculateRowsCPU<uint8_t, int>(planes, detail, result, firstBlockY, lastBlockY, fixedVarianceBins);
+    }
+}
+
+template <typename T, typename A>
+void Histogram::calculateRowsCPU(const std::vector<Plane> &planes, Detail detail, Result &result, int firstBlockY, int lastBlockY, std::vector<cl_ulong> &fixedVarianceBins) {
+    if (lastBlockY <= firstBlockY) {
+        return;
+    }
+    int numOfChannels = (color == Color::Chromatic) ? 3 : 1;
+    int shift = sampleShift();
+    int depth = bitDepth();
+    int fractionBits = (depth > 8) ? 8 : 16;
+
+    // Every thread of the pool calculates a range of block rows
+    WorkerPool &pool = workerPool();
+    int numOfThreads = std::max(std::min(pool.size(), lastBlockY - firstBlockY), 1);
+
+    // Histograms of each thread, with the variance in fixed point as in the kernels
+    std::vector<std::vector<int>> threadAverageBins(numOfThreads, std::vector<int>(3 * numOfBins));
+    std::vector<std::vector<cl_ulong>> threadVarianceBins(numOfThreads, std::vector<cl_ulong>(3 * numOfBins));
+    float *averages[3] = {result.yAverage.data(), result.uAverage.data(), result.vAverage.data()};
+    float *variances[3] = {result.yVariance.data(), result.uVariance.data(), result.vVariance.data()};
+
+    auto calculateRows = [&](int thread) {
+        int *averageBins = threadAverageBins[thread].data();
+        cl_ulong *varianceBins = threadVarianceBins[thread].data();
+        std::vector<A> sums;
+        std::vector<A> squares;
+
+        int threadFirstBlockY = firstBlockY + (int)((long long)(lastBlockY - firstBlockY) * thread / numOfThreads);
+        int threadLastBlockY = firstBlockY + (int)((long long)(lastBlockY - firstBlockY) * (thread + 1) / numOfThreads);
+        for (int blockY = threadFirstBlockY; blockY < threadLastBlockY; blockY++) {
+            for (int plane = 0; plane < numOfPlanes(); plane++) {
+                // The channels of a plane (both chroma channels of a semi-planar format or every channel of a packed one) share the column sums
+                std::vector<int> channels;
+                for (int channel = 0; channel < numOfChannels; channel++) {
+                    if (channelPlane(channel) == plane) {
+                        channels.push_back(channel);
+                    }
+                }
+                if (channels.empty()) {
+                    continue;
+                }
+                int blockH = (channels[0] == 0) ? blockHeight : blockHeight / chromaSubsamplingY();
+                int height = formatDescriptor[channels[0] * 5 + 4];
+                int y = blockY * blockH;
+
+                // Vertical sums of the rows of the block row, the edge policy repeats or skips the rows outside the image
+                sums.assign(planeWidth(plane), 0);
+                squares.assign(planeWidth(plane), 0);
+                for (int row = y; row < y + blockH; row++) {
+                    int imageRow = (edge == Edge::Clamp) ? std::min(row, height - 1) : row;
+                    if (imageRow >= height) {
+                        break;
+                    }
+                    const T *samples = (const T *)((const char *)planes[plane].data + (size_t)imageRow * planes[plane].pitch);
+                    accumulateRow(samples, planeWidth(plane), shift, &sums[0], &squares[0]);
+                }
+
+                for (int channel : channels) {
+                    int offset = formatDescriptor[channel * 5];
+                    int pixelStride = formatDescriptor[channel * 5 + 1];
+                    int width = formatDescriptor[channel * 5 + 3];
+                    int blockW = (channel == 0) ? blockWidth : blockWidth / chromaSubsamplingX();
+                    for (int blockX = 0; blockX < numOfBlocksX; blockX++) {
+                        int x = blockX * blockW;
+
+                        // Horizontal sum of the columns of the block
+                        A sum = 0;
+                        A sumSquares = 0;
+                        for (int column = x; column < x + blockW; column++) {
+                            int imageColumn = (edge == Edge::Clamp) ? std::min(column, width - 1) : column;
+                            if (imageColumn >= width) {
+                                break;
+                            }
+                            sum += sums[offset + imageColumn * pixelStride];
+                            sumSquares += squares[offset + imageColumn * pixelStride];
+                        }
+                        int count = blockW * blockH;
+                        if (edge == Edge::Partial) {
+                            count = std::min(blockW, width - x) * std::min(blockH, height - y);
+                        }
+
+                        // Same operations as the kernels, which are built without contracting them into fused multiply adds
+                        float average = (float)sum / count;
+                        float variance;
+                        if (depth > 8) {
+                            variance = (float)((cl_ulong)count * (cl_ulong)sumSquares - (cl_ulong)sum * (cl_ulong)sum) / ((float)count * count);
+                        }
+                        else {
+                            variance = (float)sumSquares / count - average * average;
+                        }
+                        int interval = ((int)average * numOfBins) >> depth;
+
+                        if (detail == Detail::Include) {
+                            averages[channel][blockY * numOfBlocksX + blockX] = average;
+                            variances[channel][blockY * numOfBlocksX + blockX] = variance;
+                        }
+                        averageBins[channel * numOfBins + interval]++;
+                        varianceBins[channel * numOfBins + interval] += (cl_ulong)(std::max(variance, 0.0f) * (float)(1 << fractionBits) + 0.5f);
+                    }
+                }
+            }
+        }
+    };
+
+    pool.run(numOfThreads, calculateRows);
+
+    // Add the histograms of the threads, in integers so the order does not change the result
+    int *averageBins[3] = {result.yAverageBins.data(), result.uAverageBins.data(), result.vAverageBins.data()};
+    for (int channel = 0; channel < numOfChannels; channel++) {
+        for (int bin = 0; bin < numOfBins; bin++) {
+            for (int thread = 0; thread < numOfThreads; thread++) {
+                averageBins[channel][bin] += threadAverageBins[thread][channel * numOfBins + bin];
+                fixedVarianceBins[channel * numOfBins + bin] += threadVarianceBins[thread][channel * numOfBins + bin];
+            }
+        }
+    }
+}
+
+void Histogram::convertVarianceBins(const std::vector<cl_ulong> &fixedVarianceBins, Result &result) {
+    varhist *bins[3] = {result.yVarianceBins.data(), result.uVarianceBins.data(), result.vVarianceBins.data()};
+    int numOfChannels = (color == Color::Chromatic) ? 3 : 1;
+    float scale = 1.0f / (float)(1 << ((bitDepth() > 8) ? 8 : 16));
+    for (int channel = 0; channel < numOfChannels; channel++) {
+        for (int bin = 0; bin < numOfBins; bin++) {
+            bins[channel][bin] = (float)fixedVarianceBins[channel * numOfBins + bin] * scale;
+        }
+    }
+}
+
+int Histogram::channelPlane(int channel) {
+    if (channel == 0 || numOfPlanes() == 1) {
+        return 0;
+    }
+    if (numOfPlanes() == 2) {
+        return 1;
+    }
+    // YV12 stores the V plane before the U plane
+    if (format == Format::YV12) {
+        return (channel == 1) ? 2 : 1;
+    }
+    return channel;
+}
+
+std::string Histogram::instructionSet() {
+    switch (cpuInstructionSet()) {
+        case InstructionSet::AVX2:
+            return "AVX2";
+        case InstructionSet::SSE4_1:
+            return "SSE4.1";
+        default:
+            return "Scalar";
+    }
+}
+
+int Histogram::cpuThreads() {
+    return (threads > 0) ? threads : std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+Histogram::WorkerPool &Histogram::workerPool() {
+    if (!workers) {
+        workers = std::make_unique<WorkerPool>(cpuThreads());
+    }
+    return *workers;
+}
+
+Histogram::WorkerPool::WorkerPool(int numOfThreads) {
+    for (int thread = 1; thread < numOfThreads; thread++) {
+        workers.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+Histogram::WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    taskReady.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void Histogram::WorkerPool::run(int numOfTasks, const std::function<void(int)> &task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->task = &task;
+    this->numOfTasks = numOfTasks;
+    nextTask = 0;
+    pendingTasks = numOfTasks;
+    taskReady.notify_all();
+
+    // The calling thread takes tasks as well, then waits for the ones still running on the workers
+    while (nextTask < numOfTasks) {
+        int index = nextTask++;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        pendingTasks--;
+    }
+    tasksDone.wait(lock, [this]() { return pendingTasks == 0; });
+    this->task = NULL;
+    this->numOfTasks = 0;
+    nextTask = 0;
+}
+
+int Histogram::WorkerPool::size() {
+    return (int)workers.size() + 1;
+}
+
+void Histogram::WorkerPool::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        taskReady.wait(lock, [this]() { return stop || nextTask < numOfTasks; });
+        if (stop) {
+            return;
+        }
+        int index = nextTask++;
+        lock.unlock();
+        (*task)(index);
+        lock.lock();
+        if (--pendingTasks == 0) {
+            tasksDone.notify_one();
+        }
+    }
+}
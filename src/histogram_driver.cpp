@@ -106,10 +106,8 @@ int main(int argc, char const *argv[])
     }
 
     // Read file into vector
-    std::vector<int> imageVector(imageSize);
-    for (int i = 0; i < imageSize; i++) {
-        imageVector.at(i) = inputYUV.get();
-    }
+    std::vector<uint8_t> rawImage(imageSize);
+    inputYUV.read(reinterpret_cast<char *>(rawImage.data()), imageSize);
     inputYUV.close();
 
     if (DEBUG_MODE_CPU) {
@@ -140,236 +138,173 @@ int main(int argc, char const *argv[])
     std::vector<double> vVarianceBinsCPU(NUM_OF_BINS);
 
     // Create Timer Variables
-    double yElapsedTimeAverageCPU, uElapsedTimeAverageCPU, vElapsedTimeAverageCPU;
-    double yElapsedTimeVarianceCPU, uElapsedTimeVarianceCPU, vElapsedTimeVarianceCPU;
-    double yElapsedTimeAverageHistCPU, uElapsedTimeAverageHistCPU, vElapsedTimeAverageHistCPU;
-    double yElapsedTimeVarianceHistCPU, uElapsedTimeVarianceHistCPU, vElapsedTimeVarianceHistCPU;
+    double yElapsedTimeCPU, uElapsedTimeCPU, vElapsedTimeCPU;
+    double yElapsedTimeHistCPU, uElapsedTimeHistCPU, vElapsedTimeHistCPU;
 
     if (SHOW_CPU_TEST) {
-        std::cout << "\n--------------------------AVERAGES----------------------------\n\n";
+        std::cout << "\n--------------------AVERAGES AND VARIANCES--------------------\n\n";
     }
-    // Average of Channel Y
+    // Average and Variance of Channel Y
     TimeInterval timer("milli");
-    calculateAverage(imageVector, 0, IMG_WIDTH, yNumOfBlocks, yBlockSize, yBlockWidth, yBlockHeight, yAverageCPU);
-    yElapsedTimeAverageCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time Y Channel Average (ms) = " << yElapsedTimeAverageCPU << std::endl;
-    }
-
-    
-    // Average of Channel U
-    timer = TimeInterval("milli");
-    calculateAverage(imageVector, ySize, IMG_WIDTH/2, uNumOfBlocks, uBlockSize, uBlockWidth, uBlockHeight, uAverageCPU);
-    uElapsedTimeAverageCPU = timer.Elapsed();
+    calculateAverageAndVariance(rawImage, 0, IMG_WIDTH, yNumOfBlocks, yBlockSize, yBlockWidth, yBlockHeight, yAverageCPU, yVarianceCPU);
+    yElapsedTimeCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time U Channel Average (ms) = " << uElapsedTimeAverageCPU << std::endl;
+        std::cout << "Elapsed time Y Channel Average and Variance (ms) = " << yElapsedTimeCPU << std::endl;
     }
 
-    // Average of Channel V
+    // Average and Variance of Channel U
     timer = TimeInterval("milli");
-    calculateAverage(imageVector, ySize + uSize, IMG_WIDTH/2, vNumOfBlocks, vBlockSize, vBlockWidth, vBlockHeight, vAverageCPU);
-    vElapsedTimeAverageCPU = timer.Elapsed();
+    calculateAverageAndVariance(rawImage, ySize, IMG_WIDTH/2, uNumOfBlocks, uBlockSize, uBlockWidth, uBlockHeight, uAverageCPU, uVarianceCPU);
+    uElapsedTimeCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time V Channel Average (ms) = " << vElapsedTimeAverageCPU << std::endl;
+        std::cout << "Elapsed time U Channel Average and Variance (ms) = " << uElapsedTimeCPU << std::endl;
     }
-    
 
-    if (SHOW_CPU_TEST) {
-        std::cout << "\n--------------------------VARIANCES---------------------------\n\n";
-    }
-    // Variance of Channel Y
+    // Average and Variance of Channel V
     timer = TimeInterval("milli");
-    calculateVariance(imageVector, 0, IMG_WIDTH, yNumOfBlocks, yBlockSize, yBlockWidth, yBlockHeight, yAverageCPU, yVarianceCPU);
-    yElapsedTimeVarianceCPU = timer.Elapsed();
+    calculateAverageAndVariance(rawImage, ySize + uSize, IMG_WIDTH/2, vNumOfBlocks, vBlockSize, vBlockWidth, vBlockHeight, vAverageCPU, vVarianceCPU);
+    vElapsedTimeCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time Y Channel Variance (ms) = " << yElapsedTimeVarianceCPU << std::endl;
+        std::cout << "Elapsed time V Channel Average and Variance (ms) = " << vElapsedTimeCPU << std::endl;
     }
 
-    
-    // Average of Channel U
-    timer = TimeInterval("milli");
-    calculateVariance(imageVector, ySize, IMG_WIDTH/2, uNumOfBlocks, uBlockSize, uBlockWidth, uBlockHeight, uAverageCPU, uVarianceCPU);
-    uElapsedTimeVarianceCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time U Channel Variance (ms) = " << uElapsedTimeVarianceCPU << std::endl;
-    }
-
-    // Average of Channel V
-    timer = TimeInterval("milli");
-    calculateVariance(imageVector, ySize + uSize, IMG_WIDTH/2, vNumOfBlocks, vBlockSize, vBlockWidth, vBlockHeight, vAverageCPU, vVarianceCPU);
-    vElapsedTimeVarianceCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time V Channel Variance (ms) = " << vElapsedTimeVarianceCPU << std::endl;
-    }
-    
-
     if (SHOW_CPU_TEST) {
         std::cout << "\n-------------------------HISTOGRAMS---------------------------\n\n";
     }
-    // Average Histogram of Channel Y
+    // Average and Variance Histograms of Channel Y
     timer = TimeInterval("milli");
     calculateHistogram(yAverageCPU, NUM_OF_BINS, yAverageBinsCPU);
-    yElapsedTimeAverageHistCPU = timer.Elapsed();
+    calculateHistogram(yAverageCPU, NUM_OF_BINS, yVarianceBinsCPU, yVarianceCPU);
+    yElapsedTimeHistCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time Y Channel Average Hist (ms) = " << yElapsedTimeAverageHistCPU << std::endl;
+        std::cout << "Elapsed time Y Channel Hist (ms) = " << yElapsedTimeHistCPU << std::endl;
     }
 
-    
-    // Average Histogram of Channel U
+    // Average and Variance Histograms of Channel U
     timer = TimeInterval("milli");
     calculateHistogram(uAverageCPU, NUM_OF_BINS, uAverageBinsCPU);
-    uElapsedTimeAverageHistCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time U Channel Average Hist (ms) = " << uElapsedTimeAverageHistCPU << std::endl;
-    }
-
-    // Average Histogram of Channel V
-    timer = TimeInterval("milli");
-    calculateHistogram(vAverageCPU, NUM_OF_BINS, vAverageBinsCPU);
-    vElapsedTimeAverageHistCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time V Channel Average Hist (ms) = " << vElapsedTimeAverageHistCPU << std::endl;
-    }
-    
-
-    // Variance Histogram of Channel Y
-    timer = TimeInterval("milli");
-    calculateHistogram(yAverageCPU, NUM_OF_BINS, yVarianceBinsCPU, yVarianceCPU);
-    yElapsedTimeVarianceHistCPU = timer.Elapsed();
-    if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time Y Channel Variance Hist (ms) = " << yElapsedTimeVarianceHistCPU << std::endl;
-    }
-    
-    
-    // Variance Histogram of Channel U
-    timer = TimeInterval("milli");
     calculateHistogram(uAverageCPU, NUM_OF_BINS, uVarianceBinsCPU, uVarianceCPU);
-    uElapsedTimeVarianceHistCPU = timer.Elapsed();
+    uElapsedTimeHistCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time U Channel Variance Hist (ms) = " << uElapsedTimeVarianceHistCPU << std::endl;
+        std::cout << "Elapsed time U Channel Hist (ms) = " << uElapsedTimeHistCPU << std::endl;
     }
 
-    // Variance Histogram of Channel V
+    // Average and Variance Histograms of Channel V
     timer = TimeInterval("milli");
+    calculateHistogram(vAverageCPU, NUM_OF_BINS, vAverageBinsCPU);
     calculateHistogram(vAverageCPU, NUM_OF_BINS, vVarianceBinsCPU, vVarianceCPU);
-    vElapsedTimeVarianceHistCPU = timer.Elapsed();
+    vElapsedTimeHistCPU = timer.Elapsed();
     if (SHOW_CPU_TEST) {
-        std::cout << "Elapsed time V Channel Variance Hist (ms) = " << vElapsedTimeVarianceHistCPU << std::endl;
+        std::cout << "Elapsed time V Channel Hist (ms) = " << vElapsedTimeHistCPU << std::endl;
     }
-    
 
+    double elapsedTimeAllHistCPU = yElapsedTimeCPU + uElapsedTimeCPU + vElapsedTimeCPU + yElapsedTimeHistCPU + uElapsedTimeHistCPU + vElapsedTimeHistCPU;
     if (SHOW_CPU_TEST) {
         std::cout << "\n---------------------------SUMMARY----------------------------\n\n";
-        std::cout << "Elapsed time Average (Y + U + V) (ms) = " << yElapsedTimeAverageCPU + uElapsedTimeAverageCPU + vElapsedTimeAverageCPU << std::endl;
-        std::cout << "Elapsed time Variance (Y + U + V) (ms) = " << yElapsedTimeVarianceCPU + uElapsedTimeVarianceCPU + vElapsedTimeVarianceCPU << std::endl;
-        std::cout << "Elapsed time Average Hist (Y + U + V) (ms) = " << yElapsedTimeAverageHistCPU + uElapsedTimeAverageHistCPU + vElapsedTimeAverageHistCPU << std::endl;
-        std::cout << "Elapsed time Variance Hist (Y + U + V) (ms) = " << yElapsedTimeVarianceHistCPU + uElapsedTimeVarianceHistCPU + vElapsedTimeVarianceHistCPU << std::endl;
-        std::cout << "Elapsed time Channel Y (Avg + Var) (ms) = " << yElapsedTimeAverageCPU + yElapsedTimeVarianceCPU << std::endl;
-        std::cout << "Elapsed time Channel U (Avg + Var) (ms) = " << uElapsedTimeAverageCPU + uElapsedTimeVarianceCPU << std::endl;
-        std::cout << "Elapsed time Channel V (Avg + Var) (ms) = " << vElapsedTimeAverageCPU + vElapsedTimeVarianceCPU << std::endl;
-        std::cout << "Elapsed time Channel Y (Avg + Var + Hist) (ms) = " << yElapsedTimeAverageCPU + yElapsedTimeVarianceCPU + yElapsedTimeAverageHistCPU + yElapsedTimeVarianceHistCPU << std::endl;
-        std::cout << "Elapsed time Channel U (Avg + Var + Hist) (ms) = " << uElapsedTimeAverageCPU + uElapsedTimeVarianceCPU + uElapsedTimeAverageHistCPU + uElapsedTimeVarianceHistCPU << std::endl;
-        std::cout << "Elapsed time Channel V (Avg + Var + Hist) (ms) = " << vElapsedTimeAverageCPU + vElapsedTimeVarianceCPU + vElapsedTimeAverageHistCPU + vElapsedTimeVarianceHistCPU << std::endl;
-        std::cout << "Total Elapsed time (ms) = " << yElapsedTimeAverageCPU + yElapsedTimeVarianceCPU + yElapsedTimeAverageHistCPU + yElapsedTimeVarianceHistCPU + uElapsedTimeAverageCPU + uElapsedTimeVarianceCPU + uElapsedTimeAverageHistCPU + uElapsedTimeVarianceHistCPU + vElapsedTimeAverageCPU + vElapsedTimeVarianceCPU + vElapsedTimeAverageHistCPU + vElapsedTimeVarianceHistCPU << std::endl;
-    
+        std::cout << "Elapsed time Average and Variance (Y + U + V) (ms) = " << yElapsedTimeCPU + uElapsedTimeCPU + vElapsedTimeCPU << std::endl;
+        std::cout << "Elapsed time Hist (Y + U + V) (ms) = " << yElapsedTimeHistCPU + uElapsedTimeHistCPU + vElapsedTimeHistCPU << std::endl;
+        std::cout << "Total Elapsed time (ms) = " << elapsedTimeAllHistCPU << std::endl;
     }
 
     std::cout << "\n=============================GPU==============================\n\n";
 
-    // Create Output Vectors
-    std::vector<float> yAverageGPU(yNumOfBlocks);
-    std::vector<float> uAverageGPU(uNumOfBlocks);
-    std::vector<float> vAverageGPU(vNumOfBlocks);
-    std::vector<float> yVarianceGPU(yNumOfBlocks);
-    std::vector<float> uVarianceGPU(uNumOfBlocks);
-    std::vector<float> vVarianceGPU(vNumOfBlocks);
-    std::vector<int> yAverageHistGPU(NUM_OF_BINS);
-    std::vector<int> uAverageHistGPU(NUM_OF_BINS);
-    std::vector<int> vAverageHistGPU(NUM_OF_BINS);
-    std::vector<varhist> yVarianceHistGPU(NUM_OF_BINS);
-    std::vector<varhist> uVarianceHistGPU(NUM_OF_BINS);
-    std::vector<varhist> vVarianceHistGPU(NUM_OF_BINS);
+    // Create Output Result, reused by every frame
+    Histogram::Result result;
 
     // Create instance of Histogram Library
-    Histogram histogram(Histogram::Format::YUV, Histogram::Color::Chromatic, IMG_WIDTH, IMG_HEIGHT, BLOCK_WIDTH, BLOCK_HEIGHT, NUM_OF_BINS);
+    Histogram histogram(Histogram::Format::YUV, Histogram::Color::Chromatic, Histogram::Input::Native, IMG_WIDTH, IMG_HEIGHT, BLOCK_WIDTH, BLOCK_HEIGHT, NUM_OF_BINS);
 
     // Setup Environment
     histogram.setupEnvironment();
     histogram.printEnvironment();
 
     // Write Image Buffer
-    histogram.writeInputBuffers(imageVector);
+    histogram.writeInputBuffers(rawImage);
 
     // Calculate Histograms
-    histogram.calculateHistograms(Histogram::Detail::Include);
-
-    // Get output values
-    yAverageGPU = histogram.getAverage(Histogram::Channel::Y);
-    uAverageGPU = histogram.getAverage(Histogram::Channel::U);
-    vAverageGPU = histogram.getAverage(Histogram::Channel::V);
-
-    yVarianceGPU = histogram.getVariance(Histogram::Channel::Y);
-    uVarianceGPU = histogram.getVariance(Histogram::Channel::U);
-    vVarianceGPU = histogram.getVariance(Histogram::Channel::V);
-
-    yAverageHistGPU = histogram.getAverageHistogram(Histogram::Channel::Y);
-    uAverageHistGPU = histogram.getAverageHistogram(Histogram::Channel::U);
-    vAverageHistGPU = histogram.getAverageHistogram(Histogram::Channel::V);
-
-    yVarianceHistGPU = histogram.getVarianceHistogram(Histogram::Channel::Y);
-    uVarianceHistGPU = histogram.getVarianceHistogram(Histogram::Channel::U);
-    vVarianceHistGPU = histogram.getVarianceHistogram(Histogram::Channel::V);
+    histogram.calculateHistograms(Histogram::Detail::Include, result);
 
     // Create Timer Variables
-    double elapsedTimeAllHistGPU = histogram.getElapsedTime();
+    double elapsedTimeAllHistGPU = result.elapsedTime;
 
     // Validate Average Histogram Vectors
     std::cout << "\n---------------------------VALIDATING----------------------------\n\n";
     std::cout << "Validating Y Average GPU: ";
-    validateVectorError(yAverageGPU, yAverageCPU);
+    validateVectorError(result.yAverage, yAverageCPU);
 
     std::cout << "Validating U Average GPU: ";
-    validateVectorError(uAverageGPU, uAverageCPU);
+    validateVectorError(result.uAverage, uAverageCPU);
 
     std::cout << "Validating V Average GPU: ";
-    validateVectorError(vAverageGPU, vAverageCPU);
+    validateVectorError(result.vAverage, vAverageCPU);
 
     // Validate Variance Histogram Vectors
     std::cout << "Validating Y Variance GPU: ";
-    validateVectorError(yVarianceGPU, yVarianceCPU);
+    validateVectorError(result.yVariance, yVarianceCPU);
 
     std::cout << "Validating U Variance GPU: ";
-    validateVectorError(uVarianceGPU, uVarianceCPU);
+    validateVectorError(result.uVariance, uVarianceCPU);
 
     std::cout << "Validating V Variance GPU: ";
-    validateVectorError(vVarianceGPU, vVarianceCPU);
+    validateVectorError(result.vVariance, vVarianceCPU);
 
     // Validate Average Histogram Vectors
     std::cout << "Validating Y Average Hist GPU: ";
-    validateVectorError(yAverageHistGPU, yAverageBinsCPU);
+    validateVectorError(result.yAverageBins, yAverageBinsCPU);
 
     std::cout << "Validating U Average Hist GPU: ";
-    validateVectorError(uAverageHistGPU, uAverageBinsCPU);
+    validateVectorError(result.uAverageBins, uAverageBinsCPU);
 
     std::cout << "Validating V Average Hist GPU: ";
-    validateVectorError(vAverageHistGPU, vAverageBinsCPU);
+    validateVectorError(result.vAverageBins, vAverageBinsCPU);
 
     // Validate Variance Histogram Vectors
     std::cout << "Validating Y Variance Hist GPU: ";
-    validateVectorError(yVarianceHistGPU, yVarianceBinsCPU);
+    validateVectorError(result.yVarianceBins, yVarianceBinsCPU);
 
     std::cout << "Validating U Variance Hist GPU: ";
-    validateVectorError(uVarianceHistGPU, uVarianceBinsCPU);
+    validateVectorError(result.uVarianceBins, uVarianceBinsCPU);
 
     std::cout << "Validating V Variance Hist GPU: ";
-    validateVectorError(vVarianceHistGPU, vVarianceBinsCPU);
-    
+    validateVectorError(result.vVarianceBins, vVarianceBinsCPU);
+
+    std::cout << "\n=========================CPU BACKEND==========================\n\n";
+
+    // Create Output Result for the CPU backend
+    Histogram::Result resultCPU;
+
+    // Same settings on the multithreaded SIMD CPU backend, which must give the same results as the kernels
+    Histogram histogramCPU = histogram;
+    histogramCPU.setBackend(Histogram::Backend::CPU);
+    histogramCPU.setupEnvironment();
+    histogramCPU.printEnvironment();
+    histogramCPU.writeInputBuffers(rawImage);
+    histogramCPU.calculateHistograms(Histogram::Detail::Include, resultCPU);
+
+    double elapsedTimeAllHistCPUBackend = resultCPU.elapsedTime;
+
+    // Compare the CPU backend with the OpenCL results
+    std::cout << "\n---------------------------COMPARING----------------------------\n\n";
+    std::cout << "Comparing Y Average CPU backend: " << (validateVector(resultCPU.yAverage, result.yAverage) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing U Average CPU backend: " << (validateVector(resultCPU.uAverage, result.uAverage) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing V Average CPU backend: " << (validateVector(resultCPU.vAverage, result.vAverage) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing Y Variance CPU backend: " << (validateVector(resultCPU.yVariance, result.yVariance) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing U Variance CPU backend: " << (validateVector(resultCPU.uVariance, result.uVariance) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing V Variance CPU backend: " << (validateVector(resultCPU.vVariance, result.vVariance) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing Y Average Hist CPU backend: " << (validateVector(resultCPU.yAverageBins, result.yAverageBins) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing U Average Hist CPU backend: " << (validateVector(resultCPU.uAverageBins, result.uAverageBins) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing V Average Hist CPU backend: " << (validateVector(resultCPU.vAverageBins, result.vAverageBins) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing Y Variance Hist CPU backend: " << (validateVector(resultCPU.yVarianceBins, result.yVarianceBins) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing U Variance Hist CPU backend: " << (validateVector(resultCPU.uVarianceBins, result.uVarianceBins) ? "PASS" : "FAIL") << std::endl;
+    std::cout << "Comparing V Variance Hist CPU backend: " << (validateVector(resultCPU.vVarianceBins, result.vVarianceBins) ? "PASS" : "FAIL") << std::endl;
 
     std::cout << "\n---------------------------PERFORMANCE----------------------------\n\n";
+    std::cout << "Elapsed time CPU reference (ms) = " << elapsedTimeAllHistCPU << std::endl;
     std::cout << "Elapsed time (ms) = " << elapsedTimeAllHistGPU << std::endl;
+    std::cout << "Elapsed time CPU backend (ms) = " << elapsedTimeAllHistCPUBackend << std::endl;
     
  
-    imageVector.clear();
+    rawImage.clear();
 
     return 0;
 }
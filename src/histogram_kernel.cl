@@ -0,0 +1,1051 @@
+/**
+ * @file histogram_kernel.cl
+ * @brief Kernel file for the library, portable to any OpenCL 3.0 device
+ */
+#pragma CL_VERSION_3_0
+
+// Keep the multiplications and subtractions of blockVariance separate, as the CPU backend does
+#pragma OPENCL FP_CONTRACT OFF
+
+#ifndef PIXEL_TYPE
+/**
+ * @brief Storage type of the raw image samples.
+ * Defaults to int, the host builds with uchar for native 8 bit input.
+ */
+#define PIXEL_TYPE int
+#endif
+
+#ifndef BIT_DEPTH
+/**
+ * @brief Bit depth of the image samples.
+ */
+#define BIT_DEPTH 8
+#endif
+
+#ifndef SAMPLE_SHIFT
+/**
+ * @brief Shift that aligns the samples to the least significant bit (used by MSB aligned formats such as P010).
+ */
+#define SAMPLE_SHIFT 0
+#endif
+
+#ifndef WIDE_ACCUMULATORS
+/**
+ * @brief Set by the host when the sum of squares of an 8 bit block does not fit in 32 bits, for blocks of more than 33025 pixels.
+ */
+#define WIDE_ACCUMULATORS 0
+#endif
+
+/**
+ * @brief Type of the block accumulators, wide enough to hold the sum of squares of a high bit depth block or of a large 8 bit block.
+ */
+#if BIT_DEPTH > 8 || WIDE_ACCUMULATORS
+#define ACC_TYPE ulong
+#else
+#define ACC_TYPE int
+#endif
+
+#ifndef SUB_GROUP_REDUCE
+/**
+ * @brief Set by the host when the device supports sub groups, the segments that span whole sub groups are then reduced with sub_group_reduce_add.
+ */
+#define SUB_GROUP_REDUCE 0
+#endif
+
+#ifndef WORK_GROUP_REDUCE
+/**
+ * @brief Set by the host when the device supports the work group collective functions, a segment that spans the whole work group is then reduced with work_group_reduce_add.
+ */
+#define WORK_GROUP_REDUCE 0
+#endif
+
+#if SUB_GROUP_REDUCE && defined(cl_khr_subgroups)
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+#ifndef INT64_ATOMICS
+/**
+ * @brief Set by the host when the device supports cl_khr_int64_base_atomics, otherwise the 64 bit additions are done with two 32 bit atomics.
+ */
+#define INT64_ATOMICS 0
+#endif
+
+#if INT64_ATOMICS
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#endif
+
+#ifndef TWO_STAGE_REDUCE
+/**
+ * @brief Set by the host for the two stage reduction, every work group then writes its own partial histograms, which are added in a fixed order by reduceHistograms instead of with global atomics.
+ */
+#define TWO_STAGE_REDUCE 0
+#endif
+
+/**
+ * @brief Fractional bits of the fixed point variance histograms.
+ * The variance of each block is rounded to 64 bit fixed point before it is accumulated, so the sums are exact and do not depend on the order of the atomics, which gives the same histograms on every device.
+ */
+#if BIT_DEPTH > 8
+#define VARIANCE_FRACTION_BITS 8
+#else
+#define VARIANCE_FRACTION_BITS 16
+#endif
+
+/**
+ * @brief Reads a sample from the raw image data aligned to the least significant bit.
+ * 
+ * @param pixels pointer to raw image data.
+ * @param index position of the sample.
+ * @return the value of the sample.
+ */
+inline ACC_TYPE readSample(global const PIXEL_TYPE *pixels, int index) {
+    return (ACC_TYPE)(pixels[index] >> SAMPLE_SHIFT);
+}
+
+/**
+ * @brief Calculates the variance of a block from its accumulated sum and sum of squares.
+ * High bit depth blocks are reduced with integer math, as the float difference loses the precision of the result.
+ * 
+ * @param sum the sum of the samples of the block.
+ * @param sumSquares the sum of the squares of the samples of the block.
+ * @param count the number of samples of the block.
+ * @return the variance of the block.
+ */
+inline float blockVariance(ACC_TYPE sum, ACC_TYPE sumSquares, int count) {
+#if BIT_DEPTH > 8
+    return (float)(count * sumSquares - sum * sum) / ((float)count * count);
+#else
+    float average = (float)sum/count;
+    return (float)sumSquares/count - average * average;
+#endif
+}
+
+/**
+ * @brief Fields of the format descriptor written by the host.
+ * Each channel is described by its offset, pixel stride and row stride (in samples) and its width and height, followed by the chroma subsampling of the format, the edge policy, the distance in samples between the frames of a batch, the number of blocks of the image in each dimension, the size of the luma blocks and the geometry of the work groups.
+ */
+#define FORMAT_Y 0
+#define FORMAT_U 5
+#define FORMAT_V 10
+#define FORMAT_CHROMA_SUBSAMPLING_X 15
+#define FORMAT_CHROMA_SUBSAMPLING_Y 16
+#define FORMAT_EDGE 17
+#define FORMAT_FRAME_STRIDE 18
+#define FORMAT_NUM_OF_BLOCKS_X 19
+#define FORMAT_NUM_OF_BLOCKS_Y 20
+#define FORMAT_BLOCK_WIDTH 21
+#define FORMAT_BLOCK_HEIGHT 22
+#define FORMAT_BLOCKS_PER_GROUP 23
+#define FORMAT_ITEMS_PER_BLOCK 24
+
+/**
+ * @brief Edge policies for the blocks that cross the right and bottom edges of the image.
+ * Discard blocks are never launched, Partial blocks only use the samples inside the image, Clamp blocks repeat the last row and column.
+ */
+#define EDGE_DISCARD 0
+#define EDGE_PARTIAL 1
+#define EDGE_CLAMP 2
+
+/**
+ * @brief Configuration fixed by the host when it builds the kernels, so the compiler folds the block geometry, the pixel strides and the bin scaling and unrolls the reductions.
+ * When a value is not defined it is read at run time from the format descriptor, the number of bins or the launch.
+ */
+#ifndef NUM_OF_BINS
+#define NUM_OF_BINS numOfBins[0]
+#endif
+#ifndef BLOCK_WIDTH
+#define BLOCK_WIDTH format[FORMAT_BLOCK_WIDTH]
+#endif
+#ifndef BLOCK_HEIGHT
+#define BLOCK_HEIGHT format[FORMAT_BLOCK_HEIGHT]
+#endif
+#ifndef CHROMA_SUBSAMPLING_X
+#define CHROMA_SUBSAMPLING_X format[FORMAT_CHROMA_SUBSAMPLING_X]
+#endif
+#ifndef CHROMA_SUBSAMPLING_Y
+#define CHROMA_SUBSAMPLING_Y format[FORMAT_CHROMA_SUBSAMPLING_Y]
+#endif
+#ifndef EDGE_POLICY
+#define EDGE_POLICY format[FORMAT_EDGE]
+#endif
+#ifndef LOCAL_SIZE
+#define LOCAL_SIZE get_local_size(0)
+#endif
+#ifndef ITEMS_PER_BLOCK
+#define ITEMS_PER_BLOCK format[FORMAT_ITEMS_PER_BLOCK]
+#endif
+#ifndef BLOCKS_PER_GROUP
+#define BLOCKS_PER_GROUP format[FORMAT_BLOCKS_PER_GROUP]
+#endif
+#if defined(Y_PIXEL_STRIDE) && defined(CHROMA_PIXEL_STRIDE)
+#define PIXEL_STRIDE(channel) (((channel) == FORMAT_Y) ? Y_PIXEL_STRIDE : CHROMA_PIXEL_STRIDE)
+#else
+#define PIXEL_STRIDE(channel) format[(channel) + 1]
+#endif
+
+/**
+ * @brief Calculates the position of a sample in the raw image data from the format descriptor.
+ * The frame of a batch is given by the third dimension of the launch.
+ * 
+ * @param format the format descriptor of the raw image data.
+ * @param channel the first field of the channel in the format descriptor (FORMAT_Y, FORMAT_U or FORMAT_V).
+ * @param x the horizontal position of the sample in the channel.
+ * @param y the vertical position of the sample in the channel.
+ * @return the position of the sample.
+ */
+inline int sampleIndex(global const int *format, int channel, int x, int y) {
+    return (get_group_id(2) * format[FORMAT_FRAME_STRIDE]) + format[channel] + (y * format[channel + 2]) + (x * PIXEL_STRIDE(channel));
+}
+
+/**
+ * @brief Reads a sample of a channel applying the edge policy to the positions outside the image.
+ * 
+ * @param pixels pointer to raw image data.
+ * @param format the format descriptor of the raw image data.
+ * @param channel the first field of the channel in the format descriptor (FORMAT_Y, FORMAT_U or FORMAT_V).
+ * @param x the horizontal position of the sample in the channel.
+ * @param y the vertical position of the sample in the channel.
+ * @return the value of the sample, 0 if it is outside a partial block.
+ */
+inline ACC_TYPE readChannel(global const PIXEL_TYPE *pixels, global const int *format, int channel, int x, int y) {
+    if (EDGE_POLICY == EDGE_CLAMP) {
+        x = min(x, format[channel + 3] - 1);
+        y = min(y, format[channel + 4] - 1);
+    }
+    else if (x >= format[channel + 3] || y >= format[channel + 4]) {
+        return 0;
+    }
+    return readSample(pixels, sampleIndex(format, channel, x, y));
+}
+
+/**
+ * @brief Calculates the number of samples of a block, which is smaller than its size for partial edge blocks.
+ * 
+ * @param format the format descriptor of the raw image data.
+ * @param channel the first field of the channel in the format descriptor (FORMAT_Y, FORMAT_U or FORMAT_V).
+ * @param x the horizontal position of the block in the channel.
+ * @param y the vertical position of the block in the channel.
+ * @param width the width of the block.
+ * @param height the height of the block.
+ * @return the number of samples of the block.
+ */
+inline int blockCount(global const int *format, int channel, int x, int y, int width, int height) {
+    if (EDGE_POLICY == EDGE_PARTIAL) {
+        width = min(width, format[channel + 3] - x);
+        height = min(height, format[channel + 4] - y);
+    }
+    return width * height;
+}
+
+/**
+ * @brief Sums the samples of a block of a channel calculated by a work item.
+ * Every block is calculated by a segment of work items, the work item sums every step-th sample of the block starting at the given one, so any block size is covered by any number of work items.
+ * 
+ * @param pixels pointer to raw image data.
+ * @param format the format descriptor of the raw image data.
+ * @param channel the first field of the channel in the format descriptor (FORMAT_Y, FORMAT_U or FORMAT_V).
+ * @param x the horizontal position of the block in the channel.
+ * @param y the vertical position of the block in the channel.
+ * @param width the width of the block.
+ * @param height the height of the block.
+ * @param first the first sample of the block summed by the work item (its position in the segment).
+ * @param step the distance between the samples summed by the work item (the size of the segment).
+ * @param sum the sum of the samples.
+ * @param sumSquares the sum of the squares of the samples.
+ */
+inline void accumulateBlock(global const PIXEL_TYPE *pixels, global const int *format, int channel, int x, int y, int width, int height, int first, int step, ACC_TYPE *sum, ACC_TYPE *sumSquares) {
+    for (int i = first; i < width * height; i += step) {
+        ACC_TYPE sample = readChannel(pixels, format, channel, x + (i % width), y + (i / width));
+        *sum += sample;
+        *sumSquares += sample * sample;
+    }
+}
+
+/**
+ * @brief Returns the number of work items of a segment whose sums are added by a collective function.
+ * That is the whole work group when the segment spans it and the device supports the work group collective functions, or the sub group when the segment spans whole sub groups.
+ * Otherwise it returns 1 and the segment is reduced in local memory only.
+ * 
+ * @param itemsPerBlock the size of the segments.
+ * @return the distance between the partial sums left for the reduction in local memory.
+ */
+inline int collectiveItems(int itemsPerBlock) {
+#if WORK_GROUP_REDUCE
+    if (itemsPerBlock == LOCAL_SIZE) {
+        return itemsPerBlock;
+    }
+#endif
+#if SUB_GROUP_REDUCE
+    int subGroupSize = get_max_sub_group_size();
+    if (itemsPerBlock % subGroupSize == 0) {
+        return subGroupSize;
+    }
+#endif
+    return 1;
+}
+
+/**
+ * @brief Adds the sums of the work items with the collective function selected by collectiveItems.
+ * Every work item of the work group must call it, the result is the same for all the work items of the collective.
+ * 
+ * @param value the sum of the work item.
+ * @param items the number of work items added, as returned by collectiveItems.
+ * @return the sum of the collective.
+ */
+inline ACC_TYPE collectiveSum(ACC_TYPE value, int items) {
+#if WORK_GROUP_REDUCE
+    if (items == LOCAL_SIZE) {
+        return work_group_reduce_add(value);
+    }
+#endif
+#if SUB_GROUP_REDUCE
+    if (items > 1) {
+        return sub_group_reduce_add(value);
+    }
+#endif
+    return value;
+}
+
+/**
+ * @brief Converts the variance of a block to fixed point.
+ * The rounding of a flat 8 bit block can leave a tiny negative variance, which is clamped to zero as it has no unsigned value.
+ * 
+ * @param variance the variance of the block.
+ * @return the variance in fixed point with VARIANCE_FRACTION_BITS fractional bits.
+ */
+inline ulong fixedVariance(float variance) {
+    return (ulong)(fmax(variance, 0.0f) * (float)(1 << VARIANCE_FRACTION_BITS) + 0.5f);
+}
+
+/**
+ * @brief Atomic addition to a fixed point bin, with a 64 bit atomic or with two 32 bit atomics that carry into the high word.
+ * 
+ * @param bins the fixed point histogram.
+ * @param bin the bin to add to.
+ * @param value the fixed point value added to the bin.
+ */
+inline void atomicAddFixed(volatile global ulong *bins, int bin, ulong value) {
+#if INT64_ATOMICS
+    atom_add(&bins[bin], value);
+#else
+    volatile global uint *words = (volatile global uint *)&bins[bin];
+    uint low = (uint)value;
+    uint previous = atomic_add(&words[0], low);
+    uint high = (uint)(value >> 32) + ((previous + low < previous) ? 1 : 0);
+    if (high != 0) {
+        atomic_add(&words[1], high);
+    }
+#endif
+}
+
+/**
+ * @brief Reads a fixed point bin written by atomicAddFixed.
+ * 
+ * @param bins the fixed point histogram.
+ * @param bin the bin to read.
+ * @return the fixed point value of the bin.
+ */
+inline ulong readFixed(global const ulong *bins, int bin) {
+#if INT64_ATOMICS
+    return bins[bin];
+#else
+    global const uint *words = (global const uint *)&bins[bin];
+    return ((ulong)words[1] << 32) | words[0];
+#endif
+}
+
+/**
+ * @brief Calculates the offset of the histograms written by the work group.
+ * With the two stage reduction every work group has its own partial histograms, otherwise the work groups of a frame share the histograms of the frame.
+ * 
+ * @param bins the number of bins of the histograms.
+ * @return the offset of the histograms of the work group.
+ */
+inline int histogramOffset(int bins) {
+#if TWO_STAGE_REDUCE
+    return ((get_group_id(2) * get_num_groups(1) + get_group_id(1)) * get_num_groups(0) + get_group_id(0)) * bins;
+#else
+    return get_group_id(2) * bins;
+#endif
+}
+
+/**
+ * @brief Merges a bin of the histograms of the work group into the global histograms.
+ * The partial histograms of the two stage reduction are written whole, otherwise only the non empty bins are added with atomics.
+ * 
+ * @param averageBins the average histogram.
+ * @param varianceBins the fixed point variance histogram.
+ * @param groupAverageBins the average histogram of the work group.
+ * @param groupVarianceBins the fixed point variance histogram of the work group.
+ * @param bin the bin to merge.
+ */
+inline void mergeGroupBin(global int *averageBins, global ulong *varianceBins, local const int *groupAverageBins, local const ulong *groupVarianceBins, int bin) {
+#if TWO_STAGE_REDUCE
+    averageBins[bin] = groupAverageBins[bin];
+    varianceBins[bin] = groupVarianceBins[bin];
+#else
+    if (groupAverageBins[bin] != 0) {
+        atomic_add(&averageBins[bin], groupAverageBins[bin]);
+        atomicAddFixed(varianceBins, bin, groupVarianceBins[bin]);
+    }
+#endif
+}
+
+/**
+ * @brief Kernel function that calculates the histograms for a single channel.
+ * The kernel calculates the average and variance histograms based on the average and variance of each group (block of pixels).
+ * It accepts any supported format for the Luma channel, the layout is given by the format descriptor.
+ * @param pixels pointer to raw image data.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param format the format descriptor of the raw image data.
+ * @param averageBins the histogram data for the average.
+ * @param varianceBins the fixed point histogram data for the variance.
+ * @param blockSumAverage local memory for the accumulative sum (reduction) for the the average of the group.
+ * @param blockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group.
+ * @param groupAverageBins local memory for the average histogram of the work group.
+ * @param groupVarianceBins local memory for the variance histogram of the work group.
+ */
+kernel void calculateHistogramsSingleChannel(global const PIXEL_TYPE *pixels, global const int *numOfBins, global const int *format, global int *averageBins, global ulong *varianceBins, local ACC_TYPE *blockSumAverage, local ACC_TYPE *blockSumVariance, local int *groupAverageBins, local ulong *groupVarianceBins) {
+    // Get local id
+    int lid = get_local_linear_id();
+
+    // Offset the outputs to the frame of the batch
+    averageBins += histogramOffset(NUM_OF_BINS);
+    varianceBins += histogramOffset(NUM_OF_BINS);
+
+    // Get block dimensions
+    int blockWidth = BLOCK_WIDTH;
+    int blockHeight = BLOCK_HEIGHT;
+
+    // Get segment of the work item, every block is calculated by a segment of itemsPerBlock work items
+    int localSize = LOCAL_SIZE;
+    int itemsPerBlock = ITEMS_PER_BLOCK;
+    int blocksPerPass = localSize / itemsPerBlock;
+    int segment = lid / itemsPerBlock;
+    int segmentLid = lid % itemsPerBlock;
+    int reducedItems = collectiveItems(itemsPerBlock);
+
+    // Clear the histograms of the work group
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        groupAverageBins[bin] = 0;
+        groupVarianceBins[bin] = 0;
+    }
+
+    // Every work group calculates a run of consecutive blocks of a row, blocksPerPass blocks at a time
+    int blockY = get_group_id(1);
+    int firstBlockX = get_group_id(0) * BLOCKS_PER_GROUP;
+    int lastBlockX = min(firstBlockX + BLOCKS_PER_GROUP, format[FORMAT_NUM_OF_BLOCKS_X]);
+    for (int passX = firstBlockX; passX < lastBlockX; passX += blocksPerPass) {
+        int blockX = passX + segment;
+
+        // Sum the samples of the block handled by the work item
+        ACC_TYPE sum = 0;
+        ACC_TYPE sumSquares = 0;
+        if (blockX < lastBlockX) {
+            accumulateBlock(pixels, format, FORMAT_Y, blockX * blockWidth, blockY * blockHeight, blockWidth, blockHeight, segmentLid, itemsPerBlock, &sum, &sumSquares);
+        }
+
+        // Add the sums of the sub group (or of the work group) and copy them to local memory
+        blockSumAverage[lid] = collectiveSum(sum, reducedItems);
+        blockSumVariance[lid] = collectiveSum(sumSquares, reducedItems);
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Reduction of every segment, the partial sums left by the collective functions are reducedItems apart
+        for (int stride = itemsPerBlock / 2; stride >= reducedItems; stride >>= 1) {
+            if (segmentLid < stride) {
+                blockSumAverage[lid] += blockSumAverage[lid + stride];
+                blockSumVariance[lid] += blockSumVariance[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Update average array
+        if (lid == 0) {
+            for (int block = 0; block < blocksPerPass && passX + block < lastBlockX; block++) {
+                int first = block * itemsPerBlock;
+                int lumaBlockSize = blockCount(format, FORMAT_Y, (passX + block) * blockWidth, blockY * blockHeight, blockWidth, blockHeight);
+
+                // Calculate average
+                float average = (float)blockSumAverage[first]/(lumaBlockSize);
+
+                // Calculate variance
+                float variance = blockVariance(blockSumAverage[first], blockSumVariance[first], lumaBlockSize);
+
+                // Calculate bin
+                int interval = ((int)average*NUM_OF_BINS)>>BIT_DEPTH;
+
+                // Accumulate in the histograms of the work group, only the first work item writes them
+                groupAverageBins[interval]++;
+                groupVarianceBins[interval] += fixedVariance(variance);
+            }
+        }
+
+        // Wait for the blocks to be binned before the local memory is reused
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Merge the bins of the work group into the histograms
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        mergeGroupBin(averageBins, varianceBins, groupAverageBins, groupVarianceBins, bin);
+    }
+}
+
+/**
+ * @brief Kernel function that calculates the histograms for a single channel with details.
+ * The kernel calculates the average and variance histograms based on the average and variance of each group (block of pixels).
+ * The kernel also returns details for the values for the average and variance of group (block of pixels) that were calculated.
+ * It accepts any supported format for the Luma channel, the layout is given by the format descriptor.
+ * @param pixels pointer to raw image data.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param format the format descriptor of the raw image data.
+ * @param average the average data for each group.
+ * @param variance the variance data for each group.
+ * @param averageBins the histogram data for the average.
+ * @param varianceBins the fixed point histogram data for the variance.
+ * @param blockSumAverage local memory for the accumulative sum (reduction) for the the average of the group.
+ * @param blockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group.
+ * @param groupAverageBins local memory for the average histogram of the work group.
+ * @param groupVarianceBins local memory for the variance histogram of the work group.
+ */
+kernel void calculateHistogramsSingleChannelWithDetail(global const PIXEL_TYPE *pixels, global const int *numOfBins, global const int *format, global float *average, global float *variance, global int *averageBins, global ulong *varianceBins, local ACC_TYPE *blockSumAverage, local ACC_TYPE *blockSumVariance, local int *groupAverageBins, local ulong *groupVarianceBins) {
+    // Get local id
+    int lid = get_local_linear_id();
+
+    // Offset the outputs to the frame of the batch
+    average += get_group_id(2) * format[FORMAT_NUM_OF_BLOCKS_X] * format[FORMAT_NUM_OF_BLOCKS_Y];
+    variance += get_group_id(2) * format[FORMAT_NUM_OF_BLOCKS_X] * format[FORMAT_NUM_OF_BLOCKS_Y];
+    averageBins += histogramOffset(NUM_OF_BINS);
+    varianceBins += histogramOffset(NUM_OF_BINS);
+
+    // Get block dimensions
+    int blockWidth = BLOCK_WIDTH;
+    int blockHeight = BLOCK_HEIGHT;
+
+    // Get segment of the work item, every block is calculated by a segment of itemsPerBlock work items
+    int localSize = LOCAL_SIZE;
+    int itemsPerBlock = ITEMS_PER_BLOCK;
+    int blocksPerPass = localSize / itemsPerBlock;
+    int segment = lid / itemsPerBlock;
+    int segmentLid = lid % itemsPerBlock;
+    int reducedItems = collectiveItems(itemsPerBlock);
+
+    // Clear the histograms of the work group
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        groupAverageBins[bin] = 0;
+        groupVarianceBins[bin] = 0;
+    }
+
+    // Every work group calculates a run of consecutive blocks of a row, blocksPerPass blocks at a time
+    int blockY = get_group_id(1);
+    int firstBlockX = get_group_id(0) * BLOCKS_PER_GROUP;
+    int lastBlockX = min(firstBlockX + BLOCKS_PER_GROUP, format[FORMAT_NUM_OF_BLOCKS_X]);
+    for (int passX = firstBlockX; passX < lastBlockX; passX += blocksPerPass) {
+        int blockX = passX + segment;
+
+        // Sum the samples of the block handled by the work item
+        ACC_TYPE sum = 0;
+        ACC_TYPE sumSquares = 0;
+        if (blockX < lastBlockX) {
+            accumulateBlock(pixels, format, FORMAT_Y, blockX * blockWidth, blockY * blockHeight, blockWidth, blockHeight, segmentLid, itemsPerBlock, &sum, &sumSquares);
+        }
+
+        // Add the sums of the sub group (or of the work group) and copy them to local memory
+        blockSumAverage[lid] = collectiveSum(sum, reducedItems);
+        blockSumVariance[lid] = collectiveSum(sumSquares, reducedItems);
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Reduction of every segment, the partial sums left by the collective functions are reducedItems apart
+        for (int stride = itemsPerBlock / 2; stride >= reducedItems; stride >>= 1) {
+            if (segmentLid < stride) {
+                blockSumAverage[lid] += blockSumAverage[lid + stride];
+                blockSumVariance[lid] += blockSumVariance[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Update average array
+        if (lid == 0) {
+            for (int block = 0; block < blocksPerPass && passX + block < lastBlockX; block++) {
+                int first = block * itemsPerBlock;
+                int lumaBlockSize = blockCount(format, FORMAT_Y, (passX + block) * blockWidth, blockY * blockHeight, blockWidth, blockHeight);
+
+                // Calculate block linear id
+                int bid = blockY * format[FORMAT_NUM_OF_BLOCKS_X] + passX + block;
+
+                // Calculate average
+                average[bid] = (float)blockSumAverage[first]/(lumaBlockSize);
+
+                // Calculate variance
+                variance[bid] = blockVariance(blockSumAverage[first], blockSumVariance[first], lumaBlockSize);
+
+                // Calculate bin
+                int interval = ((int)average[bid]*NUM_OF_BINS)>>BIT_DEPTH;
+
+                // Accumulate in the histograms of the work group, only the first work item writes them
+                groupAverageBins[interval]++;
+                groupVarianceBins[interval] += fixedVariance(variance[bid]);
+            }
+        }
+
+        // Wait for the blocks to be binned before the local memory is reused
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Merge the bins of the work group into the histograms
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        mergeGroupBin(averageBins, varianceBins, groupAverageBins, groupVarianceBins, bin);
+    }
+}
+
+/**
+ * @brief Kernel function that calculates the histograms for all channels.
+ * The kernel calculates the average and variance histograms based on the average and variance of each group (block of pixels).
+ * It accepts any supported format, the layout and chroma subsampling are given by the format descriptor, and performs the calculation for all channels (YUV).
+ * @param pixels pointer to raw image data.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param format the format descriptor of the raw image data.
+ * @param yAverageBins the histogram data for the average for channel Y.
+ * @param yVarianceBins the fixed point histogram data for the variance for channel Y.
+ * @param uAverageBins the histogram data for the average for channel U.
+ * @param uVarianceBins the fixed point histogram data for the variance for channel U.
+ * @param vAverageBins the histogram data for the average for channel V.
+ * @param vVarianceBins the fixed point histogram data for the variance for channel V.
+ * @param yBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel Y.
+ * @param yBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel Y.
+ * @param uBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel U.
+ * @param uBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel U.
+ * @param vBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel V.
+ * @param vBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel V.
+ * @param yGroupAverageBins local memory for the average histogram of the work group for channel Y.
+ * @param yGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel Y.
+ * @param uGroupAverageBins local memory for the average histogram of the work group for channel U.
+ * @param uGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel U.
+ * @param vGroupAverageBins local memory for the average histogram of the work group for channel V.
+ * @param vGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel V.
+ */
+kernel void calculateHistograms(global const PIXEL_TYPE *pixels, global const int *numOfBins, global const int *format, global int *yAverageBins, global ulong *yVarianceBins, global int *uAverageBins, global ulong *uVarianceBins, global int *vAverageBins, global ulong *vVarianceBins, local ACC_TYPE *yBlockSumAverage, local ACC_TYPE *yBlockSumVariance, local ACC_TYPE *uBlockSumAverage, local ACC_TYPE *uBlockSumVariance, local ACC_TYPE *vBlockSumAverage, local ACC_TYPE *vBlockSumVariance, local int *yGroupAverageBins, local ulong *yGroupVarianceBins, local int *uGroupAverageBins, local ulong *uGroupVarianceBins, local int *vGroupAverageBins, local ulong *vGroupVarianceBins) {
+    // Get local id
+    int lid = get_local_linear_id();
+
+    // Offset the outputs to the frame of the batch
+    yAverageBins += histogramOffset(NUM_OF_BINS);
+    yVarianceBins += histogramOffset(NUM_OF_BINS);
+    uAverageBins += histogramOffset(NUM_OF_BINS);
+    uVarianceBins += histogramOffset(NUM_OF_BINS);
+    vAverageBins += histogramOffset(NUM_OF_BINS);
+    vVarianceBins += histogramOffset(NUM_OF_BINS);
+
+    // Get Block dimensions
+    int blockWidth = BLOCK_WIDTH;
+    int blockHeight = BLOCK_HEIGHT;
+    int chromaBlockWidth = blockWidth / CHROMA_SUBSAMPLING_X;
+    int chromaBlockHeight = blockHeight / CHROMA_SUBSAMPLING_Y;
+
+    // Get segment of the work item, every block is calculated by a segment of itemsPerBlock work items
+    int localSize = LOCAL_SIZE;
+    int itemsPerBlock = ITEMS_PER_BLOCK;
+    int blocksPerPass = localSize / itemsPerBlock;
+    int segment = lid / itemsPerBlock;
+    int segmentLid = lid % itemsPerBlock;
+    int reducedItems = collectiveItems(itemsPerBlock);
+
+    // Clear the histograms of the work group
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        yGroupAverageBins[bin] = 0;
+        yGroupVarianceBins[bin] = 0;
+        uGroupAverageBins[bin] = 0;
+        uGroupVarianceBins[bin] = 0;
+        vGroupAverageBins[bin] = 0;
+        vGroupVarianceBins[bin] = 0;
+    }
+
+    // Every work group calculates a run of consecutive blocks of a row, blocksPerPass blocks at a time
+    int blockY = get_group_id(1);
+    int firstBlockX = get_group_id(0) * BLOCKS_PER_GROUP;
+    int lastBlockX = min(firstBlockX + BLOCKS_PER_GROUP, format[FORMAT_NUM_OF_BLOCKS_X]);
+    for (int passX = firstBlockX; passX < lastBlockX; passX += blocksPerPass) {
+        int blockX = passX + segment;
+
+        // Sum the samples of the block handled by the work item for each channel
+        ACC_TYPE ySum = 0;
+        ACC_TYPE ySumSquares = 0;
+        ACC_TYPE uSum = 0;
+        ACC_TYPE uSumSquares = 0;
+        ACC_TYPE vSum = 0;
+        ACC_TYPE vSumSquares = 0;
+        if (blockX < lastBlockX) {
+            accumulateBlock(pixels, format, FORMAT_Y, blockX * blockWidth, blockY * blockHeight, blockWidth, blockHeight, segmentLid, itemsPerBlock, &ySum, &ySumSquares);
+            accumulateBlock(pixels, format, FORMAT_U, blockX * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight, segmentLid, itemsPerBlock, &uSum, &uSumSquares);
+            accumulateBlock(pixels, format, FORMAT_V, blockX * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight, segmentLid, itemsPerBlock, &vSum, &vSumSquares);
+        }
+
+        // Add the sums of the sub group (or of the work group) and copy them to local memory for each channel
+        yBlockSumAverage[lid] = collectiveSum(ySum, reducedItems);
+        yBlockSumVariance[lid] = collectiveSum(ySumSquares, reducedItems);
+        uBlockSumAverage[lid] = collectiveSum(uSum, reducedItems);
+        uBlockSumVariance[lid] = collectiveSum(uSumSquares, reducedItems);
+        vBlockSumAverage[lid] = collectiveSum(vSum, reducedItems);
+        vBlockSumVariance[lid] = collectiveSum(vSumSquares, reducedItems);
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Reduction of every segment, the partial sums left by the collective functions are reducedItems apart
+        for (int stride = itemsPerBlock / 2; stride >= reducedItems; stride >>= 1) {
+            if (segmentLid < stride) {
+                yBlockSumAverage[lid] += yBlockSumAverage[lid + stride];
+                yBlockSumVariance[lid] += yBlockSumVariance[lid + stride];
+                uBlockSumAverage[lid] += uBlockSumAverage[lid + stride];
+                uBlockSumVariance[lid] += uBlockSumVariance[lid + stride];
+                vBlockSumAverage[lid] += vBlockSumAverage[lid + stride];
+                vBlockSumVariance[lid] += vBlockSumVariance[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Update average array
+        if (lid == 0) {
+            for (int block = 0; block < blocksPerPass && passX + block < lastBlockX; block++) {
+                int first = block * itemsPerBlock;
+                int lumaBlockSize = blockCount(format, FORMAT_Y, (passX + block) * blockWidth, blockY * blockHeight, blockWidth, blockHeight);
+                int chromaBlockSize = blockCount(format, FORMAT_U, (passX + block) * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight);
+
+                // Calculate average
+                float yAverage = (float)yBlockSumAverage[first]/(lumaBlockSize);
+                float uAverage = (float)uBlockSumAverage[first]/(chromaBlockSize);
+                float vAverage = (float)vBlockSumAverage[first]/(chromaBlockSize);
+
+                // Calculate variance
+                float yVariance = blockVariance(yBlockSumAverage[first], yBlockSumVariance[first], lumaBlockSize);
+                float uVariance = blockVariance(uBlockSumAverage[first], uBlockSumVariance[first], chromaBlockSize);
+                float vVariance = blockVariance(vBlockSumAverage[first], vBlockSumVariance[first], chromaBlockSize);
+
+                // Calculate bin
+                int yInterval = ((int)yAverage*NUM_OF_BINS)>>BIT_DEPTH;
+                int uInterval = ((int)uAverage*NUM_OF_BINS)>>BIT_DEPTH;
+                int vInterval = ((int)vAverage*NUM_OF_BINS)>>BIT_DEPTH;
+
+                // Accumulate in the histograms of the work group, only the first work item writes them
+                yGroupAverageBins[yInterval]++;
+                uGroupAverageBins[uInterval]++;
+                vGroupAverageBins[vInterval]++;
+                yGroupVarianceBins[yInterval] += fixedVariance(yVariance);
+                uGroupVarianceBins[uInterval] += fixedVariance(uVariance);
+                vGroupVarianceBins[vInterval] += fixedVariance(vVariance);
+            }
+        }
+
+        // Wait for the blocks to be binned before the local memory is reused
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Merge the bins of the work group into the histograms
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        mergeGroupBin(yAverageBins, yVarianceBins, yGroupAverageBins, yGroupVarianceBins, bin);
+        mergeGroupBin(uAverageBins, uVarianceBins, uGroupAverageBins, uGroupVarianceBins, bin);
+        mergeGroupBin(vAverageBins, vVarianceBins, vGroupAverageBins, vGroupVarianceBins, bin);
+    }
+}
+
+/**
+ * @brief Kernel function that calculates the histograms for all channels with details.
+ * The kernel calculates the average and variance histograms based on the average and variance of each group (block of pixels).
+ * The kernel also returns details for the values for the average and variance of group (block of pixels) that were calculated.
+ * It accepts any supported format, the layout and chroma subsampling are given by the format descriptor, and performs the calculation for all channels (YUV).
+ * @param pixels pointer to raw image data.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param format the format descriptor of the raw image data.
+ * @param yAverage the average data for each group for channel Y.
+ * @param yVariance the variance data for each group for channel Y.
+ * @param yAverageBins the histogram data for the average for channel Y.
+ * @param yVarianceBins the fixed point histogram data for the variance for channel Y.
+ * @param uAverage the average data for each group for channel U.
+ * @param uVariance the variance data for each group for channel U.
+ * @param uAverageBins the histogram data for the average for channel U.
+ * @param uVarianceBins the fixed point histogram data for the variance for channel U.
+ * @param vAverage the average data for each group for channel V.
+ * @param vVariance the variance data for each group for channel V.
+ * @param vAverageBins the histogram data for the average for channel V.
+ * @param vVarianceBins the fixed point histogram data for the variance for channel V.
+ * @param yBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel Y.
+ * @param yBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel Y.
+ * @param uBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel U.
+ * @param uBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel U.
+ * @param vBlockSumAverage local memory for the accumulative sum (reduction) for the the average of the group for channel V.
+ * @param vBlockSumVariance local memory for the accumulative sum (reduction) for the the variance of the group for channel V.
+ * @param yGroupAverageBins local memory for the average histogram of the work group for channel Y.
+ * @param yGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel Y.
+ * @param uGroupAverageBins local memory for the average histogram of the work group for channel U.
+ * @param uGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel U.
+ * @param vGroupAverageBins local memory for the average histogram of the work group for channel V.
+ * @param vGroupVarianceBins local memory for the fixed point variance histogram of the work group for channel V.
+ */
+kernel void calculateHistogramsWithDetail(global const PIXEL_TYPE *pixels, global const int *numOfBins, global const int *format, global float *yAverage, global float *yVariance, global int *yAverageBins, global ulong *yVarianceBins, global float *uAverage, global float *uVariance, global int *uAverageBins, global ulong *uVarianceBins, global float *vAverage, global float *vVariance, global int *vAverageBins, global ulong *vVarianceBins, local ACC_TYPE *yBlockSumAverage, local ACC_TYPE *yBlockSumVariance, local ACC_TYPE *uBlockSumAverage, local ACC_TYPE *uBlockSumVariance, local ACC_TYPE *vBlockSumAverage, local ACC_TYPE *vBlockSumVariance, local int *yGroupAverageBins, local ulong *yGroupVarianceBins, local int *uGroupAverageBins, local ulong *uGroupVarianceBins, local int *vGroupAverageBins, local ulong *vGroupVarianceBins) {
+    // Get local id
+    int lid = get_local_linear_id();
+
+    // Offset the outputs to the frame of the batch
+    int numOfBlocks = format[FORMAT_NUM_OF_BLOCKS_X] * format[FORMAT_NUM_OF_BLOCKS_Y];
+    yAverage += get_group_id(2) * numOfBlocks;
+    yVariance += get_group_id(2) * numOfBlocks;
+    uAverage += get_group_id(2) * numOfBlocks;
+    uVariance += get_group_id(2) * numOfBlocks;
+    vAverage += get_group_id(2) * numOfBlocks;
+    vVariance += get_group_id(2) * numOfBlocks;
+    yAverageBins += histogramOffset(NUM_OF_BINS);
+    yVarianceBins += histogramOffset(NUM_OF_BINS);
+    uAverageBins += histogramOffset(NUM_OF_BINS);
+    uVarianceBins += histogramOffset(NUM_OF_BINS);
+    vAverageBins += histogramOffset(NUM_OF_BINS);
+    vVarianceBins += histogramOffset(NUM_OF_BINS);
+
+    // Get Block dimensions
+    int blockWidth = BLOCK_WIDTH;
+    int blockHeight = BLOCK_HEIGHT;
+    int chromaBlockWidth = blockWidth / CHROMA_SUBSAMPLING_X;
+    int chromaBlockHeight = blockHeight / CHROMA_SUBSAMPLING_Y;
+
+    // Get segment of the work item, every block is calculated by a segment of itemsPerBlock work items
+    int localSize = LOCAL_SIZE;
+    int itemsPerBlock = ITEMS_PER_BLOCK;
+    int blocksPerPass = localSize / itemsPerBlock;
+    int segment = lid / itemsPerBlock;
+    int segmentLid = lid % itemsPerBlock;
+    int reducedItems = collectiveItems(itemsPerBlock);
+
+    // Clear the histograms of the work group
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        yGroupAverageBins[bin] = 0;
+        yGroupVarianceBins[bin] = 0;
+        uGroupAverageBins[bin] = 0;
+        uGroupVarianceBins[bin] = 0;
+        vGroupAverageBins[bin] = 0;
+        vGroupVarianceBins[bin] = 0;
+    }
+
+    // Every work group calculates a run of consecutive blocks of a row, blocksPerPass blocks at a time
+    int blockY = get_group_id(1);
+    int firstBlockX = get_group_id(0) * BLOCKS_PER_GROUP;
+    int lastBlockX = min(firstBlockX + BLOCKS_PER_GROUP, format[FORMAT_NUM_OF_BLOCKS_X]);
+    for (int passX = firstBlockX; passX < lastBlockX; passX += blocksPerPass) {
+        int blockX = passX + segment;
+
+        // Sum the samples of the block handled by the work item for each channel
+        ACC_TYPE ySum = 0;
+        ACC_TYPE ySumSquares = 0;
+        ACC_TYPE uSum = 0;
+        ACC_TYPE uSumSquares = 0;
+        ACC_TYPE vSum = 0;
+        ACC_TYPE vSumSquares = 0;
+        if (blockX < lastBlockX) {
+            accumulateBlock(pixels, format, FORMAT_Y, blockX * blockWidth, blockY * blockHeight, blockWidth, blockHeight, segmentLid, itemsPerBlock, &ySum, &ySumSquares);
+            accumulateBlock(pixels, format, FORMAT_U, blockX * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight, segmentLid, itemsPerBlock, &uSum, &uSumSquares);
+            accumulateBlock(pixels, format, FORMAT_V, blockX * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight, segmentLid, itemsPerBlock, &vSum, &vSumSquares);
+        }
+
+        // Add the sums of the sub group (or of the work group) and copy them to local memory for each channel
+        yBlockSumAverage[lid] = collectiveSum(ySum, reducedItems);
+        yBlockSumVariance[lid] = collectiveSum(ySumSquares, reducedItems);
+        uBlockSumAverage[lid] = collectiveSum(uSum, reducedItems);
+        uBlockSumVariance[lid] = collectiveSum(uSumSquares, reducedItems);
+        vBlockSumAverage[lid] = collectiveSum(vSum, reducedItems);
+        vBlockSumVariance[lid] = collectiveSum(vSumSquares, reducedItems);
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Reduction of every segment, the partial sums left by the collective functions are reducedItems apart
+        for (int stride = itemsPerBlock / 2; stride >= reducedItems; stride >>= 1) {
+            if (segmentLid < stride) {
+                yBlockSumAverage[lid] += yBlockSumAverage[lid + stride];
+                yBlockSumVariance[lid] += yBlockSumVariance[lid + stride];
+                uBlockSumAverage[lid] += uBlockSumAverage[lid + stride];
+                uBlockSumVariance[lid] += uBlockSumVariance[lid + stride];
+                vBlockSumAverage[lid] += vBlockSumAverage[lid + stride];
+                vBlockSumVariance[lid] += vBlockSumVariance[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Update average array
+        if (lid == 0) {
+            for (int block = 0; block < blocksPerPass && passX + block < lastBlockX; block++) {
+                int first = block * itemsPerBlock;
+                int lumaBlockSize = blockCount(format, FORMAT_Y, (passX + block) * blockWidth, blockY * blockHeight, blockWidth, blockHeight);
+                int chromaBlockSize = blockCount(format, FORMAT_U, (passX + block) * chromaBlockWidth, blockY * chromaBlockHeight, chromaBlockWidth, chromaBlockHeight);
+
+                // Calculate block linear id
+                int bid = blockY * format[FORMAT_NUM_OF_BLOCKS_X] + passX + block;
+
+                // Calculate average
+                yAverage[bid] = (float)yBlockSumAverage[first]/(lumaBlockSize);
+                uAverage[bid] = (float)uBlockSumAverage[first]/(chromaBlockSize);
+                vAverage[bid] = (float)vBlockSumAverage[first]/(chromaBlockSize);
+
+                // Calculate variance
+                yVariance[bid] = blockVariance(yBlockSumAverage[first], yBlockSumVariance[first], lumaBlockSize);
+                uVariance[bid] = blockVariance(uBlockSumAverage[first], uBlockSumVariance[first], chromaBlockSize);
+                vVariance[bid] = blockVariance(vBlockSumAverage[first], vBlockSumVariance[first], chromaBlockSize);
+
+                // Calculate bin
+                int yInterval = ((int)yAverage[bid]*NUM_OF_BINS)>>BIT_DEPTH;
+                int uInterval = ((int)uAverage[bid]*NUM_OF_BINS)>>BIT_DEPTH;
+                int vInterval = ((int)vAverage[bid]*NUM_OF_BINS)>>BIT_DEPTH;
+
+                // Accumulate in the histograms of the work group, only the first work item writes them
+                yGroupAverageBins[yInterval]++;
+                uGroupAverageBins[uInterval]++;
+                vGroupAverageBins[vInterval]++;
+                yGroupVarianceBins[yInterval] += fixedVariance(yVariance[bid]);
+                uGroupVarianceBins[uInterval] += fixedVariance(uVariance[bid]);
+                vGroupVarianceBins[vInterval] += fixedVariance(vVariance[bid]);
+            }
+        }
+
+        // Wait for the blocks to be binned before the local memory is reused
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Merge the bins of the work group into the histograms
+    for (int bin = lid; bin < NUM_OF_BINS; bin += localSize) {
+        mergeGroupBin(yAverageBins, yVarianceBins, yGroupAverageBins, yGroupVarianceBins, bin);
+        mergeGroupBin(uAverageBins, uVarianceBins, uGroupAverageBins, uGroupVarianceBins, bin);
+        mergeGroupBin(vAverageBins, vVarianceBins, vGroupAverageBins, vGroupVarianceBins, bin);
+    }
+}
+
+/**
+ * @brief Kernel function that converts the fixed point variance histograms to float.
+ * The first dimension of the launch is the bin (of every frame of a batch) and the second one the channel.
+ * @param yFixedBins the fixed point variance histogram of the Luma channel.
+ * @param uFixedBins the fixed point variance histogram of the Chroma U channel.
+ * @param vFixedBins the fixed point variance histogram of the Chroma V channel.
+ * @param yVarianceBins the variance histogram of the Luma channel.
+ * @param uVarianceBins the variance histogram of the Chroma U channel.
+ * @param vVarianceBins the variance histogram of the Chroma V channel.
+ */
+kernel void convertVarianceHistograms(global const ulong *yFixedBins, global const ulong *uFixedBins, global const ulong *vFixedBins, global float *yVarianceBins, global float *uVarianceBins, global float *vVarianceBins) {
+    int bin = get_global_id(0);
+    float scale = 1.0f / (float)(1 << VARIANCE_FRACTION_BITS);
+    if (get_global_id(1) == 0) {
+        yVarianceBins[bin] = (float)readFixed(yFixedBins, bin) * scale;
+    }
+    else if (get_global_id(1) == 1) {
+        uVarianceBins[bin] = (float)readFixed(uFixedBins, bin) * scale;
+    }
+    else {
+        vVarianceBins[bin] = (float)readFixed(vFixedBins, bin) * scale;
+    }
+}
+
+/**
+ * @brief Kernel function that adds the histograms of a frame to the totals accumulated across frames.
+ * The first dimension of the launch is the bin and the second one the channel.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param yAverageBins the average histogram of the Luma channel.
+ * @param yFixedBins the fixed point variance histogram of the Luma channel.
+ * @param uAverageBins the average histogram of the Chroma U channel.
+ * @param uFixedBins the fixed point variance histogram of the Chroma U channel.
+ * @param vAverageBins the average histogram of the Chroma V channel.
+ * @param vFixedBins the fixed point variance histogram of the Chroma V channel.
+ * @param totals the 64 bit totals, the average histogram followed by the fixed point variance histogram of every channel.
+ */
+kernel void accumulateHistograms(global const int *numOfBins, global const int *yAverageBins, global const ulong *yFixedBins, global const int *uAverageBins, global const ulong *uFixedBins, global const int *vAverageBins, global const ulong *vFixedBins, global ulong *totals) {
+    int bin = get_global_id(0);
+    int channel = get_global_id(1);
+
+    // Select the histograms of the channel
+    global const int *averageBins = yAverageBins;
+    global const ulong *fixedBins = yFixedBins;
+    if (channel == 1) {
+        averageBins = uAverageBins;
+        fixedBins = uFixedBins;
+    }
+    else if (channel == 2) {
+        averageBins = vAverageBins;
+        fixedBins = vFixedBins;
+    }
+
+    // Every work item owns its bins of the totals, so no atomics are needed
+    totals[2 * channel * NUM_OF_BINS + bin] += (ulong)averageBins[bin];
+    totals[(2 * channel + 1) * NUM_OF_BINS + bin] += readFixed(fixedBins, bin);
+}
+
+/**
+ * @brief Kernel function that adds the partial histograms of the work groups of the two stage reduction.
+ * Every work group adds a bin (of every frame of a batch) of a channel, the second dimension of the launch, and its size must be a power of two.
+ * Each work item adds the work groups strided by the size of the work group, and the work items are then added in a tree, both in a fixed order, so the result does not depend on the scheduling of the device.
+ * @param numOfBins the number of bins on the calculated histograms.
+ * @param numOfGroups the number of work groups of each frame.
+ * @param yPartialAverageBins the average histograms of the work groups of the Luma channel.
+ * @param yPartialVarianceBins the fixed point variance histograms of the work groups of the Luma channel.
+ * @param uPartialAverageBins the average histograms of the work groups of the Chroma U channel.
+ * @param uPartialVarianceBins the fixed point variance histograms of the work groups of the Chroma U channel.
+ * @param vPartialAverageBins the average histograms of the work groups of the Chroma V channel.
+ * @param vPartialVarianceBins the fixed point variance histograms of the work groups of the Chroma V channel.
+ * @param yAverageBins the average histogram of the Luma channel.
+ * @param yVarianceBins the variance histogram of the Luma channel.
+ * @param uAverageBins the average histogram of the Chroma U channel.
+ * @param uVarianceBins the variance histogram of the Chroma U channel.
+ * @param vAverageBins the average histogram of the Chroma V channel.
+ * @param vVarianceBins the variance histogram of the Chroma V channel.
+ * @param yVarianceFixedBins the fixed point variance histogram of the Luma channel.
+ * @param uVarianceFixedBins the fixed point variance histogram of the Chroma U channel.
+ * @param vVarianceFixedBins the fixed point variance histogram of the Chroma V channel.
+ * @param averageSums the sums of the average bin of each work item, in local memory.
+ * @param varianceSums the sums of the fixed point variance bin of each work item, in local memory.
+ */
+kernel void reduceHistograms(global const int *numOfBins, int numOfGroups, global const int *yPartialAverageBins, global const ulong *yPartialVarianceBins, global const int *uPartialAverageBins, global const ulong *uPartialVarianceBins, global const int *vPartialAverageBins, global const ulong *vPartialVarianceBins, global int *yAverageBins, global float *yVarianceBins, global int *uAverageBins, global float *uVarianceBins, global int *vAverageBins, global float *vVarianceBins, global ulong *yVarianceFixedBins, global ulong *uVarianceFixedBins, global ulong *vVarianceFixedBins, local int *averageSums, local ulong *varianceSums) {
+    int index = get_group_id(0);
+    int lid = get_local_id(0);
+    int localSize = get_local_size(0);
+    int bin = index % NUM_OF_BINS;
+    int frame = index / NUM_OF_BINS;
+
+    // Select the histograms of the channel
+    global const int *partialAverageBins = yPartialAverageBins;
+    global const ulong *partialVarianceBins = yPartialVarianceBins;
+    global int *averageBins = yAverageBins;
+    global float *varianceBins = yVarianceBins;
+    global ulong *varianceFixedBins = yVarianceFixedBins;
+    if (get_global_id(1) == 1) {
+        partialAverageBins = uPartialAverageBins;
+        partialVarianceBins = uPartialVarianceBins;
+        averageBins = uAverageBins;
+        varianceBins = uVarianceBins;
+        varianceFixedBins = uVarianceFixedBins;
+    }
+    else if (get_global_id(1) == 2) {
+        partialAverageBins = vPartialAverageBins;
+        partialVarianceBins = vPartialVarianceBins;
+        averageBins = vAverageBins;
+        varianceBins = vVarianceBins;
+        varianceFixedBins = vVarianceFixedBins;
+    }
+
+    // Add the bin of the work groups of the frame strided by the size of the work group
+    int averageSum = 0;
+    ulong varianceSum = 0;
+    for (int group = frame * numOfGroups + lid; group < (frame + 1) * numOfGroups; group += localSize) {
+        averageSum += partialAverageBins[group * NUM_OF_BINS + bin];
+        varianceSum += partialVarianceBins[group * NUM_OF_BINS + bin];
+    }
+    averageSums[lid] = averageSum;
+    varianceSums[lid] = varianceSum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Add the sums of the work items in a tree
+    for (int stride = localSize / 2; stride > 0; stride /= 2) {
+        if (lid < stride) {
+            averageSums[lid] += averageSums[lid + stride];
+            varianceSums[lid] += varianceSums[lid + stride];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0) {
+        averageBins[index] = averageSums[0];
+        varianceFixedBins[index] = varianceSums[0];
+        varianceBins[index] = (float)varianceSums[0] * (1.0f / (float)(1 << VARIANCE_FRACTION_BITS));
+    }
+}
\ No newline at end of file